@@ -0,0 +1,1793 @@
+// gamma-core.c — presets, LUTs, the commit path and topology (see gamma-core.h)
+//
+// Linked into the gamma binary and into libgamma; the command line and
+// daemon are in gamma.c.
+
+#define _GNU_SOURCE 1
+#include "gamma-core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BOARD_DB
+#include "gamma-board.h"         /* board_db[BOARD_DB_LEN] */
+#endif
+
+/* ----------------- Helpers ----------------- */
+
+bool parse_uint32(const char *s, uint32_t *out) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 0);
+    if (errno || end == s || (end && *end)) return false;
+    *out = (uint32_t)v;
+    return true;
+}
+
+bool parse_double_strict(const char *s, double *out) {
+    char *end = NULL;
+    errno = 0;
+    double v = strtod(s, &end);
+    if (errno || end == s || *end != '\0') return false;
+    if (!isfinite(v)) return false;
+    *out = v;
+    return true;
+}
+
+bool parse_double_in_range(const char *label, const char *s,
+                           double minv, double maxv, double *out) {
+    double v;
+    if (!parse_double_strict(s, &v)) {
+        fprintf(stderr, "Invalid %s: '%s'\n", label, s);
+        return false;
+    }
+    if (v < minv || v > maxv) {
+        fprintf(stderr, "%s out of range: %g (allowed %.2f..%.2f)\n",
+                label, v, minv, maxv);
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+/* "ctm = 1.1 -0.05 -0.05  -0.05 1.1 -0.05  -0.05 -0.05 1.1": nine
+ * coefficients, row-major, separated by spaces or commas. The all-zero
+ * matrix is rejected; lut_params uses it to mean "no CTM". */
+static bool parse_ctm(const char *s, double *m) {
+    char buf[256];
+    if (strlen(s) >= sizeof(buf)) { fprintf(stderr, "Invalid ctm: '%s'\n", s); return false; }
+    strcpy(buf, s);
+    int n = 0;
+    bool nonzero = false;
+    for (char *save = NULL, *tok = strtok_r(buf, " \t,", &save); tok; tok = strtok_r(NULL, " \t,", &save)) {
+        if (n == 9) { n++; break; }
+        if (!parse_double_in_range("ctm", tok, CTM_MIN, CTM_MAX, &m[n])) return false;
+        nonzero |= m[n++] != 0.0;
+    }
+    if (n != 9 || !nonzero) {
+        fprintf(stderr, "Invalid ctm: '%s' (expected 9 coefficients, not all zero)\n", s);
+        return false;
+    }
+    return true;
+}
+
+/* -------------- INI handling -------------- */
+
+#define INI_MAX_FILES   5
+#define INI_VALUE_MAX   512
+
+static struct ini_file ini_files[INI_MAX_FILES];
+static int ini_nfiles;
+
+static bool ini_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Whitespace on both ends, then a UTF-8 BOM if present */
+static struct ini_span span_trim(const char *p, const char *end) {
+    while (p < end && ini_space(*p)) p++;
+    while (end > p && ini_space(end[-1])) end--;
+    if (end - p >= 3 && (unsigned char)p[0] == 0xEF && (unsigned char)p[1] == 0xBB &&
+        (unsigned char)p[2] == 0xBF) {
+        p += 3;
+    }
+    return (struct ini_span){ p, (size_t)(end - p) };
+}
+
+bool span_eq(struct ini_span s, const char *str) {
+    return strlen(str) == s.len && !memcmp(s.p, str, s.len);
+}
+
+void span_str(struct ini_span s, char *buf, size_t size) {
+    size_t n = s.len < size - 1 ? s.len : size - 1;
+    memcpy(buf, s.p, n);
+    buf[n] = '\0';
+}
+
+/* Per-channel keys: ch[field][channel] in preset_vals and lut_params */
+const char *const ch_keys[3][3] = {
+    { "gamma_r", "gamma_g", "gamma_b" },
+    { "lift_r",  "lift_g",  "lift_b"  },
+    { "gain_r",  "gain_g",  "gain_b"  },
+};
+static const double ch_min[3] = { GAMMA_MIN, LIFT_MIN, GAIN_MIN };
+static const double ch_max[3] = { GAMMA_MAX, LIFT_MAX, GAIN_MAX };
+
+static bool ch_key(struct ini_span key, int *field, int *chan) {
+    for (int f = 0; f < 3; f++) {
+        for (int c = 0; c < 3; c++) {
+            if (span_eq(key, ch_keys[f][c])) { *field = f; *chan = c; return true; }
+        }
+    }
+    return false;
+}
+
+static bool ini_grow(void **arr, int n, int *cap, size_t elem) {
+    if (n < *cap) return true;
+    int ncap = *cap ? *cap * 2 : 32;
+    void *p = realloc(*arr, (size_t)ncap * elem);
+    if (!p) return false;
+    *arr = p;
+    *cap = ncap;
+    return true;
+}
+
+/* One pass over the mapping: "[name]" opens a section, "key = value" adds
+ * an entry to it, '#' or ';' starts a comment, anything else is ignored. */
+bool ini_index(struct ini_file *f) {
+    int cap_sec = 0, cap_ent = 0;
+    const char *p = f->map, *end = f->map + f->len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *le = nl ? nl : end;
+        const char *cut = p;
+        while (cut < le && *cut != '#' && *cut != ';') cut++;
+        struct ini_span line = span_trim(p, cut);
+        p = nl ? nl + 1 : end;
+        if (!line.len) continue;
+
+        if (line.p[0] == '[') {
+            const char *rb = memchr(line.p, ']', line.len);
+            if (!rb) continue;
+            const char *ne = rb - (line.p + 1) > INI_NAME_MAX ? line.p + 1 + INI_NAME_MAX : rb;
+            if (!ini_grow((void **)&f->sec, f->nsec, &cap_sec, sizeof(*f->sec))) return false;
+            f->sec[f->nsec++] = (struct ini_section){
+                .name = span_trim(line.p + 1, ne), .first = f->nent,
+            };
+            continue;
+        }
+
+        const char *eq = memchr(line.p, '=', line.len);
+        if (!eq || !f->nsec) continue;
+        if (!ini_grow((void **)&f->ent, f->nent, &cap_ent, sizeof(*f->ent))) return false;
+        f->ent[f->nent++] = (struct ini_entry){
+            .key = span_trim(line.p, eq),
+            .val = span_trim(eq + 1, line.p + line.len),
+        };
+        f->sec[f->nsec - 1].count++;
+    }
+    return true;
+}
+
+bool db_valid(const char *map, size_t len) {
+    const struct preset_db_hdr *h = (const void *)map;
+    if (len < sizeof(*h) || h->version != PRESET_DB_VERSION ||
+        h->vals_size != sizeof(struct preset_vals) || h->count > INT32_MAX) {
+        return false;
+    }
+    uint64_t n = h->count;
+    return h->entries_off % 8 == 0 && h->entries_off <= len &&
+           n * sizeof(struct preset_db_entry) <= len - h->entries_off &&
+           h->order_off % 4 == 0 && h->order_off <= len &&
+           n * sizeof(uint32_t) <= len - h->order_off &&
+           h->names_off <= len && h->names_len <= len - h->names_off;
+}
+
+/* Map path into f; a compiled database is recognised by its magic. */
+void ini_map(struct ini_file *f, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        f->present = st.st_size == 0;   /* empty file: nothing to map */
+        void *m = st.st_size > 0 ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                                 : MAP_FAILED;
+        if (m != MAP_FAILED) {
+            f->map = m;
+            f->len = (size_t)st.st_size;
+            f->present = true;
+        }
+    }
+    close(fd);
+
+    if (f->len >= 4 && !memcmp(f->map, "GPDB", 4)) {
+        if (db_valid(f->map, f->len)) {
+            f->db = (const void *)f->map;
+        } else {
+            fprintf(stderr, "Ignoring %s: preset database from an incompatible build.\n", path);
+            munmap((void *)f->map, f->len);
+            f->map = NULL;
+            f->len = 0;
+            f->present = false;
+        }
+    }
+}
+
+void ini_unmap(struct ini_file *f) {
+#ifdef BOARD_DB
+    if (f->map == (const char *)board_db) f->map = NULL;
+#endif
+    if (f->map) munmap((void *)f->map, f->len);
+    f->map = NULL;
+    f->len = 0;
+    f->db = NULL;
+    f->present = false;
+}
+
+/* presets.ini -> presets.bin; any other name gets ".bin" appended */
+bool db_sibling(const char *path, char *buf, size_t size) {
+    size_t n = strlen(path);
+    if (n > 4 && !strcmp(path + n - 4, ".ini")) n -= 4;
+    return (size_t)snprintf(buf, size, "%.*s.bin", (int)n, path) < size;
+}
+
+static bool mtime_before(const struct stat *a, const struct stat *b) {
+    return a->st_mtim.tv_sec < b->st_mtim.tv_sec ||
+           (a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec < b->st_mtim.tv_nsec);
+}
+
+/* The index for path, built on first use. A missing file yields an empty,
+ * non-present entry, so absent files are not probed again either. A
+ * compiled sibling is used instead unless the INI was modified after it. */
+const struct ini_file *ini_open(const char *path) {
+    for (int i = 0; i < ini_nfiles; i++) {
+        if (!strcmp(ini_files[i].path, path)) return &ini_files[i];
+    }
+
+    static struct ini_file none;
+    if (ini_nfiles == INI_MAX_FILES || strlen(path) >= sizeof(none.path)) return &none;
+    struct ini_file *f = &ini_files[ini_nfiles++];
+    memset(f, 0, sizeof(*f));
+    strcpy(f->path, path);
+#ifdef BOARD_DB
+    if (!strcmp(path, BOARD_DB_PATH)) {
+        if (db_valid((const char *)board_db, BOARD_DB_LEN)) {
+            f->map = (const char *)board_db;
+            f->len = BOARD_DB_LEN;
+            f->db = (const void *)board_db;
+            f->present = true;
+        } else {
+            fprintf(stderr, "Ignoring %s: preset database from an incompatible build.\n", path);
+        }
+        return f;
+    }
+#endif
+
+    char bin[PATH_MAX];
+    struct stat sb, si;
+    if (db_sibling(path, bin, sizeof(bin)) && stat(bin, &sb) == 0 &&
+        (stat(path, &si) < 0 || !mtime_before(&sb, &si))) {
+        ini_map(f, bin);
+        if (f->db) return f;
+        ini_unmap(f);
+    }
+
+    ini_map(f, path);
+    if (f->present && !f->db && !ini_index(f)) {
+        fprintf(stderr, "Out of memory indexing %s\n", path);
+        f->nsec = f->nent = 0;
+    }
+    return f;
+}
+
+/* Forget path's index, so the next lookup sees the file as it is now. */
+void ini_drop(const char *path) {
+    for (int i = 0; i < ini_nfiles; i++) {
+        struct ini_file *f = &ini_files[i];
+        if (strcmp(f->path, path)) continue;
+        ini_unmap(f);
+        free(f->sec);
+        free(f->ent);
+        *f = ini_files[--ini_nfiles];
+        return;
+    }
+}
+
+/* Forget every index */
+void ini_reset(void) {
+    while (ini_nfiles) ini_drop(ini_files[0].path);
+}
+
+static const struct preset_db_entry *db_entries(const struct ini_file *f) {
+    return (const void *)(f->map + f->db->entries_off);
+}
+
+static const char *db_name(const struct ini_file *f, uint32_t i) {
+    const struct preset_db_hdr *h = f->db;
+    const char *pool = f->map + h->names_off;
+    uint32_t off = db_entries(f)[i].name_off;
+    if (off >= h->names_len || !memchr(pool + off, '\0', h->names_len - off)) return "";
+    return pool + off;
+}
+
+/* Binary search of the name table; -1 if absent */
+static int db_find(const struct ini_file *f, const char *want) {
+    int lo = 0, hi = (int)f->db->count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = strcmp(db_name(f, (uint32_t)mid), want);
+        if (!c) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+/* Call fn for every preset section in path; return the number found. */
+int scan_presets_from_file(const char *path, preset_fn fn, void *ctx) {
+    const struct ini_file *f = ini_open(path);
+    int count = 0;
+    if (f->db) {
+        const uint32_t *order = (const void *)(f->map + f->db->order_off);
+        for (uint32_t i = 0; i < f->db->count; i++) {
+            if (order[i] >= f->db->count) continue;
+            fn(db_name(f, order[i]), ctx);
+            count++;
+        }
+        return count;
+    }
+    for (int i = 0; i < f->nsec; i++) {
+        const struct ini_section *s = &f->sec[i];
+        if (!s->name.len || span_eq(s->name, "config")) continue;
+        char name[INI_NAME_MAX + 1];
+        span_str(s->name, name, sizeof(name));
+        fn(name, ctx);
+        count++;
+    }
+    return count;
+}
+
+struct list_ctx {
+    const char *path;
+    int count;
+};
+
+static void list_one_preset(const char *name, void *ctx) {
+    struct list_ctx *lc = ctx;
+    if (lc->count++ == 0) printf("Available presets in %s:\n", lc->path);
+    printf("  %s\n", name);
+}
+
+static int list_presets_from_file(const char *path) {
+    struct list_ctx lc = { .path = path };
+    return scan_presets_from_file(path, list_one_preset, &lc);
+}
+
+/* Sections sharing a name are merged in file order.
+ * return: 1=loaded, 0=not found, -1=parse error */
+int index_preset(const struct ini_file *f, const char *want, struct preset_vals *pv) {
+    int status = 0; /* 0=notfound, 1=loaded, -1=error */
+
+    for (int i = 0; i < f->nsec && status >= 0; i++) {
+        if (!span_eq(f->sec[i].name, want)) continue;
+        for (int j = f->sec[i].first; j < f->sec[i].first + f->sec[i].count; j++) {
+            struct ini_span key = f->ent[j].key;
+            char val[INI_VALUE_MAX];
+            span_str(f->ent[j].val, val, sizeof(val));
+
+            double dtmp; uint32_t utmp; int cf, cc;
+            if (span_eq(key, "gamma")) {
+                if (parse_double_in_range("gamma", val, GAMMA_MIN, GAMMA_MAX, &dtmp)) { pv->gamma=dtmp; pv->have_gamma=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "lift")) {
+                if (parse_double_in_range("lift", val, LIFT_MIN, LIFT_MAX, &dtmp)) { pv->lift=dtmp; pv->have_lift=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "gain")) {
+                if (parse_double_in_range("gain", val, GAIN_MIN, GAIN_MAX, &dtmp)) { pv->gain=dtmp; pv->have_gain=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "r")) {
+                if (parse_double_in_range("r", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->r=dtmp; pv->have_r=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "g")) {
+                if (parse_double_in_range("g", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->g=dtmp; pv->have_g=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "b")) {
+                if (parse_double_in_range("b", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->b=dtmp; pv->have_b=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "degamma")) {
+                if (parse_double_in_range("degamma", val, GAMMA_MIN, GAMMA_MAX, &dtmp)) { pv->degamma=dtmp; pv->have_degamma=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "ctm")) {
+                if (parse_ctm(val, pv->ctm)) { pv->have_ctm=true; status=1; }
+                else { status=-1; break; }
+            } else if (ch_key(key, &cf, &cc)) {
+                if (parse_double_in_range(ch_keys[cf][cc], val, ch_min[cf], ch_max[cf], &dtmp)) { pv->ch[cf][cc]=dtmp; pv->have_ch[cf][cc]=true; status=1; }
+                else { status=-1; break; }
+            } else if (span_eq(key, "crtc")) {
+                if (parse_uint32(val, &utmp)) { pv->crtc=utmp; pv->have_crtc=true; status=1; }
+                else { fprintf(stderr,"Invalid crtc in preset: '%s'\n", val); status=-1; break; }
+            } else {
+                /* ignore unknown keys */
+            }
+        }
+    }
+    return status;
+}
+
+static int load_preset_from_file(const char *path, const char *want, struct preset_vals *pv) {
+    const struct ini_file *f = ini_open(path);
+    if (!f->db) return index_preset(f, want, pv);
+    int k = db_find(f, want);
+    if (k < 0) return 0;
+    *pv = db_entries(f)[k].vals;
+    return 1;
+}
+
+/* The first crtc key in a [config] section.
+ * return: 1=loaded, 0=not found, -1=parse error */
+int index_config_crtc(const struct ini_file *f, uint32_t *out_crtc) {
+    for (int i = 0; i < f->nsec; i++) {
+        if (!span_eq(f->sec[i].name, "config")) continue;
+        for (int j = f->sec[i].first; j < f->sec[i].first + f->sec[i].count; j++) {
+            if (!span_eq(f->ent[j].key, "crtc")) continue;
+            char val[INI_VALUE_MAX];
+            span_str(f->ent[j].val, val, sizeof(val));
+            uint32_t utmp;
+            if (!parse_uint32(val, &utmp)) {
+                fprintf(stderr, "Invalid crtc in config: '%s'\n", val);
+                return -1;
+            }
+            *out_crtc = utmp;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int load_config_crtc_from_file(const char *path, uint32_t *out_crtc) {
+    const struct ini_file *f = ini_open(path);
+    if (!f->db) return index_config_crtc(f, out_crtc);
+    if (!f->db->has_config) return 0;
+    *out_crtc = f->db->config_crtc;
+    return 1;
+}
+
+/* Without --presets, the first file that has a preset wins */
+static const char *const preset_search[] = {
+#ifdef BOARD_DB
+    BOARD_DB_PATH,
+#endif
+    "./presets.ini",
+    "/etc/gamma-presets.ini",
+};
+#define PRESET_SEARCH_N ((int)(sizeof(preset_search) / sizeof(preset_search[0])))
+
+int load_config_crtc(const char *preset_path, uint32_t *out_crtc) {
+    if (preset_path) {
+        return load_config_crtc_from_file(preset_path, out_crtc);
+    }
+
+    int st = 0;
+    for (int k = 0; k < PRESET_SEARCH_N && st == 0; k++) {
+        st = load_config_crtc_from_file(preset_search[k], out_crtc);
+    }
+    return st;
+}
+
+int load_preset(const char *name, const char *preset_path, struct preset_vals *pv) {
+    memset(pv, 0, sizeof(*pv));
+
+    if (strcmp(name, "reset")==0) {
+        pv->have_gamma = pv->have_lift = pv->have_gain = pv->have_r = pv->have_g = pv->have_b = true;
+        pv->gamma = 1.0; pv->lift = 0.0; pv->gain = 1.0; pv->r = pv->g = pv->b = 1.0;
+        return 1;
+    }
+
+    if (preset_path) {
+        return load_preset_from_file(preset_path, name, pv);
+    }
+
+    int st = 0;
+    for (int k = 0; k < PRESET_SEARCH_N && st == 0; k++) {
+        st = load_preset_from_file(preset_search[k], name, pv);
+    }
+    return st; /* 1=ok, 0=not found, -1=error */
+}
+
+/* Every preset name in the search path (a name may be reported twice if it
+ * appears in both files; load_preset() resolves which one wins). */
+void foreach_preset(const char *preset_path, preset_fn fn, void *ctx) {
+    if (preset_path) {
+        scan_presets_from_file(preset_path, fn, ctx);
+    } else {
+        for (int k = 0; k < PRESET_SEARCH_N; k++) scan_presets_from_file(preset_search[k], fn, ctx);
+    }
+}
+
+void list_all_presets(const char *preset_path) {
+    int total = 0;
+    if (preset_path) {
+        total += list_presets_from_file(preset_path);
+    } else {
+        for (int k = 0; k < PRESET_SEARCH_N; k++) total += list_presets_from_file(preset_search[k]);
+    }
+    if (total == 0) {
+        if (preset_path) {
+            printf("No presets found in %s.\n", preset_path);
+        } else {
+            printf("No presets.ini found.\n");
+        }
+    }
+    printf("  reset\n"); /* built-in */
+}
+
+/* ----------------- Stats ----------------- */
+
+const uint32_t stats_bounds_us[STATS_NBUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+};
+
+struct gamma_stats g_stats;
+
+void stats_observe(struct stats_hist *h, uint64_t ns) {
+    size_t b = 0;
+    while (b < STATS_NBUCKETS - 1 && ns > stats_bounds_us[b] * 1000ull) b++;
+    h->bucket[b]++;
+    h->count++;
+    h->sum_ns += ns;
+}
+
+static void stats_commit_done(int ret) {
+    if (!ret) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        g_stats.commits++;
+        g_stats.last_commit_unix_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    } else if (ret == -EBUSY) {
+        g_stats.fail_ebusy++;
+    } else if (ret == -EINVAL) {
+        g_stats.fail_einval++;
+    } else {
+        g_stats.fail_other++;
+    }
+}
+
+/* --------------- DRM work --------------- */
+
+/* One channel's curve: clamp((x^gamma + lift) * gain) * mult */
+struct lut_curve {
+    double gamma, lift, gain, mult;
+};
+
+/* Resolve the three channel curves; same[c] is the first channel whose
+ * curve before mult equals channel c's, so it is evaluated only once. */
+static void lut_curves(const struct lut_params *p, struct lut_curve *c, int *same) {
+    const double shared[3] = { p->gamma, p->lift, p->gain };
+    const double mult[3] = { p->r, p->g, p->b };
+    for (int k = 0; k < 3; k++) {
+        double v[3];
+        for (int f = 0; f < 3; f++) v[f] = p->ch_set & (1ull << (3 * f + k)) ? p->ch[f][k] : shared[f];
+        c[k] = (struct lut_curve){ .gamma = v[0], .lift = v[1], .gain = v[2], .mult = mult[k] };
+        same[k] = k;
+        for (int j = 0; j < k && same[k] == k; j++) {
+            if (c[j].gamma == c[k].gamma && c[j].lift == c[k].lift && c[j].gain == c[k].gain) same[k] = j;
+        }
+    }
+}
+
+bool color_equal(const struct lut_params *a, const struct lut_params *b) {
+    return a->degamma == b->degamma && !memcmp(a->ctm, b->ctm, sizeof(a->ctm));
+}
+
+/* Whether the open card took DRM_CLIENT_CAP_ATOMIC (see open_card_path()).
+ * Without it every CRTC is driven through the legacy gamma ioctl. */
+static bool g_atomic = true;
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* drmModeCreatePropertyBlob(), timed for --stats */
+int create_blob(int fd, const void *data, size_t len, uint32_t *id) {
+    uint64_t t0 = now_ns();
+    int ret = drmModeCreatePropertyBlob(fd, data, len, id);
+    stats_observe(&g_stats.blob_create, now_ns() - t0);
+    return ret;
+}
+
+/* return: at least len bytes (contents undefined), NULL on allocation failure */
+void *scratch(int slot, size_t len) {
+    static struct { void *p; size_t cap; } s[SCRATCH_SLOTS];
+    if (len > s[slot].cap) {
+        void *p = realloc(s[slot].p, len);
+        if (!p) return NULL;
+        s[slot].p = p;
+        s[slot].cap = len;
+    }
+    return s[slot].p;
+}
+
+/* Copy blob_id's contents into buf if it holds exactly len bytes, without
+ * the heap copy drmModeGetPropertyBlob() makes. return: whether it did */
+bool blob_read(int fd, uint32_t blob_id, void *buf, size_t len) {
+    struct drm_mode_get_blob b = { .blob_id = blob_id, .length = (uint32_t)len, .data = (uintptr_t)buf };
+    return blob_id && !drmIoctl(fd, DRM_IOCTL_MODE_GETPROPBLOB, &b) && b.length == len;
+}
+
+/* An atomic request built in place and submitted with DRM_IOCTL_MODE_ATOMIC:
+ * drmModeAtomicReq has to be allocated, and drmModeAtomicCommit() sorts a
+ * copy of it into freshly allocated arrays on every call. This one lives on
+ * the caller's stack. Properties of one object must be added back to back. */
+#define ATOMIC_MAX_PROPS (3 * MAX_CRTCS)  /* GAMMA_LUT, DEGAMMA_LUT, CTM */
+
+struct atomic_req {
+    uint32_t nobj, nprop;
+    uint32_t objs[MAX_CRTCS], count[MAX_CRTCS];
+    uint32_t props[ATOMIC_MAX_PROPS];
+    uint64_t values[ATOMIC_MAX_PROPS];
+};
+
+/* return: 0, -ENOSPC when the request is full */
+static int atomic_add(struct atomic_req *r, uint32_t obj, uint32_t prop, uint64_t value) {
+    if (r->nprop == ATOMIC_MAX_PROPS) return -ENOSPC;
+    if (!r->nobj || r->objs[r->nobj - 1] != obj) {
+        if (r->nobj == MAX_CRTCS) return -ENOSPC;
+        r->objs[r->nobj] = obj;
+        r->count[r->nobj++] = 0;
+    }
+    r->count[r->nobj - 1]++;
+    r->props[r->nprop] = prop;
+    r->values[r->nprop++] = value;
+    return 0;
+}
+
+/* Same flags and events as drmModeAtomicCommit(). return: 0, -errno */
+static int atomic_commit(int fd, const struct atomic_req *r, uint32_t flags, void *user_data) {
+    struct drm_mode_atomic a = {
+        .flags = flags,
+        .count_objs = r->nobj,
+        .objs_ptr = (uintptr_t)r->objs,
+        .count_props_ptr = (uintptr_t)r->count,
+        .props_ptr = (uintptr_t)r->props,
+        .prop_values_ptr = (uintptr_t)r->values,
+        .user_data = (uintptr_t)user_data,
+    };
+    return drmIoctl(fd, DRM_IOCTL_MODE_ATOMIC, &a) ? -errno : 0;
+}
+
+/* The legacy gamma ramp, for drivers without atomic GAMMA_LUT.
+ * return: 0 (ci->legacy false if the CRTC has no ramp either), -1 if the CRTC cannot be read */
+static int read_crtc_legacy(int fd, uint32_t crtc_id, struct crtc_info *ci) {
+    drmModeCrtc *c = drmModeGetCrtc(fd, crtc_id);
+    if (!c) return -1;
+    memset(ci, 0, sizeof(*ci));
+    ci->crtc_id = crtc_id;
+    ci->legacy = c->gamma_size > 1;
+    ci->lut_size = ci->legacy ? (uint32_t)c->gamma_size : 0;
+    ci->active = c->mode_valid;
+    drmModeFreeCrtc(c);
+    return 0;
+}
+
+static const char *const crtc_prop_names[CP_COUNT] = {
+    "GAMMA_LUT", "GAMMA_LUT_SIZE", "DEGAMMA_LUT", "DEGAMMA_LUT_SIZE", "CTM", "ACTIVE",
+};
+
+/* IDs (0 if absent) and values of crtc_id's properties, by name: one
+ * drmModeGetProperty() per property. return: 0, -1 if unreadable */
+int crtc_prop_ids(int fd, uint32_t crtc_id, uint32_t *id, uint64_t *val) {
+    drmModeObjectProperties *props =
+        drmModeObjectGetProperties(fd, crtc_id, DRM_MODE_OBJECT_CRTC);
+    if (!props) return -1;
+
+    memset(id, 0, sizeof(*id) * CP_COUNT);
+    memset(val, 0, sizeof(*val) * CP_COUNT);
+    val[CP_GAMMA_LUT_SIZE] = 256;
+    val[CP_ACTIVE] = 1;
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyRes *p = drmModeGetProperty(fd, props->props[i]);
+        if (!p) continue;
+        for (int k = 0; k < CP_COUNT; k++) {
+            if (strcmp(p->name, crtc_prop_names[k])) continue;
+            id[k] = p->prop_id;
+            val[k] = props->prop_values[i];
+        }
+        drmModeFreeProperty(p);
+    }
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+/* Fill ci from the properties crtc_prop_ids() found */
+static void crtc_info_set(struct crtc_info *ci, uint32_t crtc_id, const uint32_t *id, const uint64_t *val) {
+    ci->crtc_id = crtc_id;
+    ci->lut_prop = val[CP_GAMMA_LUT_SIZE] ? id[CP_GAMMA_LUT] : 0;
+    ci->lut_size = (uint32_t)val[CP_GAMMA_LUT_SIZE];
+    ci->lut_blob = (uint32_t)val[CP_GAMMA_LUT];
+    ci->degamma_prop = val[CP_DEGAMMA_LUT_SIZE] > 1 ? id[CP_DEGAMMA_LUT] : 0;
+    ci->degamma_size = ci->degamma_prop ? (uint32_t)val[CP_DEGAMMA_LUT_SIZE] : 0;
+    ci->ctm_prop = id[CP_CTM];
+    ci->degamma_blob = (uint32_t)val[CP_DEGAMMA_LUT];
+    ci->ctm_blob = (uint32_t)val[CP_CTM];
+    ci->active = val[CP_ACTIVE] != 0;
+    ci->legacy = false;
+}
+
+/* return: 0 with ci filled in (lut_prop 0 and legacy false if the CRTC has
+ * neither a usable GAMMA_LUT nor a legacy gamma ramp), -1 if the CRTC's
+ * properties cannot be read */
+static int read_crtc_props(int fd, uint32_t crtc_id, struct crtc_info *ci) {
+    if (!g_atomic) return read_crtc_legacy(fd, crtc_id, ci);
+    uint32_t id[CP_COUNT];
+    uint64_t val[CP_COUNT];
+    if (crtc_prop_ids(fd, crtc_id, id, val)) return -1;
+    crtc_info_set(ci, crtc_id, id, val);
+    return ci->lut_prop ? 0 : read_crtc_legacy(fd, crtc_id, ci);
+}
+
+/* Refresh only the blob values of an already probed CRTC (one ioctl, no
+ * property name lookups). return: 0, -1 if the CRTC cannot be read */
+int read_crtc_blobs(int fd, struct crtc_info *ci) {
+    if (ci->legacy) return 0;
+    drmModeObjectProperties *props =
+        drmModeObjectGetProperties(fd, ci->crtc_id, DRM_MODE_OBJECT_CRTC);
+    if (!props) return -1;
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        uint32_t v = (uint32_t)props->prop_values[i];
+        if (props->props[i] == ci->lut_prop) ci->lut_blob = v;
+        else if (props->props[i] == ci->degamma_prop) ci->degamma_blob = v;
+        else if (props->props[i] == ci->ctm_prop) ci->ctm_blob = v;
+    }
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+int probe_crtc(int fd, uint32_t crtc_id, struct crtc_info *ci) {
+    if (read_crtc_props(fd, crtc_id, ci)) {
+        perror("drmModeObjectGetProperties");
+        return -1;
+    }
+    if (!ci->lut_prop && !ci->legacy) {
+        fprintf(stderr, "CRTC %u has no GAMMA_LUT/GAMMA_LUT_SIZE or legacy gamma\n", crtc_id);
+        return -1;
+    }
+    return 0;
+}
+
+/* Legacy CRTCs take and report the ramp as three planar arrays.
+ * return: 0, or the ioctl's error */
+int legacy_get_lut(int fd, const struct crtc_info *ci, struct drm_color_lut *lut) {
+    uint32_t n = ci->lut_size;
+    uint16_t *r = scratch(SCRATCH_RAMP, 3 * (size_t)n * sizeof(*r));
+    if (!r) return -ENOMEM;
+    int ret = drmModeCrtcGetGamma(fd, ci->crtc_id, n, r, r + n, r + 2 * n);
+    for (uint32_t i = 0; !ret && i < n; i++) {
+        lut[i] = (struct drm_color_lut){ .red = r[i], .green = r[n + i], .blue = r[2 * n + i] };
+    }
+    return ret;
+}
+
+static int legacy_set_lut(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut) {
+    uint32_t n = ci->lut_size;
+    uint16_t *r = scratch(SCRATCH_RAMP, 3 * (size_t)n * sizeof(*r));
+    if (!r) return -ENOMEM;
+    for (uint32_t i = 0; i < n; i++) {
+        r[i] = lut[i].red;
+        r[n + i] = lut[i].green;
+        r[2 * n + i] = lut[i].blue;
+    }
+    return drmModeCrtcSetGamma(fd, ci->crtc_id, n, r, r + n, r + 2 * n);
+}
+
+void identity_lut(struct drm_color_lut *lut, uint32_t lut_size) {
+    for (uint32_t i = 0; i < lut_size; i++) {
+        uint16_t v = u16clamp((double)i * 65535.0 / (double)(lut_size - 1));
+        lut[i].red = lut[i].green = lut[i].blue = v;
+        lut[i].reserved = 0;
+    }
+}
+
+/* Fetch the LUT the CRTC is showing right now; falls back to identity when no
+ * GAMMA_LUT is set or its size does not match. */
+void read_current_lut(int fd, const struct crtc_info *ci, struct drm_color_lut *lut) {
+    if (ci->legacy) {
+        if (legacy_get_lut(fd, ci, lut)) identity_lut(lut, ci->lut_size);
+        return;
+    }
+    if (!blob_read(fd, ci->lut_blob, lut, sizeof(*lut) * ci->lut_size)) identity_lut(lut, ci->lut_size);
+}
+
+void build_lut(const struct lut_params *p, struct drm_color_lut *lut, uint32_t lut_size) {
+    struct lut_curve c[3];
+    int same[3];
+    lut_curves(p, c, same);
+
+    for (uint32_t i = 0; i < lut_size; i++) {
+        double x = (double)i / (double)(lut_size - 1);
+        double y[3];
+        for (int k = 0; k < 3; k++) {
+            if (same[k] != k) { y[k] = y[same[k]]; continue; }
+            y[k] = pow(x, c[k].gamma);
+            y[k] += c[k].lift;
+            y[k] *= c[k].gain;
+            if (y[k] < 0.0) y[k] = 0.0;
+            if (y[k] > 1.0) y[k] = 1.0;
+        }
+
+        double r = fmax(0.0, fmin(1.0, y[0] * c[0].mult));
+        double g = fmax(0.0, fmin(1.0, y[1] * c[1].mult));
+        double b = fmax(0.0, fmin(1.0, y[2] * c[2].mult));
+
+        lut[i].red   = u16clamp(r * 65535.0);
+        lut[i].green = u16clamp(g * 65535.0);
+        lut[i].blue  = u16clamp(b * 65535.0);
+        lut[i].reserved = 0;
+    }
+}
+
+const char *const lut_dither_names[3] = { "none", "ordered", "diffuse" };
+
+/* reset: linear stays bit-perfect at any depth */
+static bool params_identity(const struct lut_params *p) {
+    return p->gamma == 1.0 && p->lift == 0.0 && p->gain == 1.0 &&
+           p->r == 1.0 && p->g == 1.0 && p->b == 1.0 && !p->ch_set;
+}
+
+static void quantize_lut(struct drm_color_lut *lut, uint32_t lut_size, uint32_t bits,
+                         enum lut_dither dither) {
+    static const double thr[4] = { 0.125, 0.625, 0.375, 0.875 };
+    const double levels = (double)((1u << bits) - 1);
+    double err[3] = { 0 };
+    for (uint32_t i = 0; i < lut_size; i++) {
+        uint16_t *v[3] = { &lut[i].red, &lut[i].green, &lut[i].blue };
+        for (int c = 0; c < 3; c++) {
+            double t = *v[c] * levels / 65535.0, q;
+            if (dither == LUT_DITHER_ORDERED) {
+                q = floor(t + thr[i & 3]);
+            } else if (dither == LUT_DITHER_DIFFUSE) {
+                q = round(t + err[c]);
+                err[c] += t - q;
+            } else {
+                q = round(t);
+            }
+            q = fmax(0.0, fmin(levels, q));
+            *v[c] = u16clamp(q * 65535.0 / levels);
+        }
+    }
+}
+
+/* ---------------- Blending ---------------- */
+
+static const char *const blend_mode_names[] = { "lut", "params" };
+
+bool parse_blend_mode(const char *s, enum blend_mode *mode) {
+    for (int k = 0; k < 2; k++) {
+        if (!strcmp(s, blend_mode_names[k])) {
+            *mode = (enum blend_mode)k;
+            return true;
+        }
+    }
+    fprintf(stderr, "--blend-mode takes lut or params.\n");
+    return false;
+}
+
+/* Linear blend of two LUTs in 16.16 fixed point; t is clamped to [0,1]. */
+void lerp_lut(const struct drm_color_lut *from, const struct drm_color_lut *to,
+              struct drm_color_lut *out, uint32_t lut_size, double t) {
+    uint32_t w = (uint32_t)(fmax(0.0, fmin(1.0, t)) * 65536.0);
+    uint32_t iw = 65536 - w;
+    for (uint32_t i = 0; i < lut_size; i++) {
+        out[i].red   = (uint16_t)((from[i].red   * iw + to[i].red   * w + 32768) >> 16);
+        out[i].green = (uint16_t)((from[i].green * iw + to[i].green * w + 32768) >> 16);
+        out[i].blue  = (uint16_t)((from[i].blue  * iw + to[i].blue  * w + 32768) >> 16);
+        out[i].reserved = 0;
+    }
+}
+
+/* --blend-mode params (and --adaptive): the curve parameters of a and b
+ * mixed at t (0..1). Both are within GAMMA_MIN..GAIN_MAX, so is every blend;
+ * DEGAMMA_LUT and CTM cannot be blended and come from the nearer preset. */
+void blend_params(const struct lut_params *a, const struct lut_params *b, double t,
+                  struct lut_params *out) {
+    *out = t < 0.5 ? *a : *b;
+    out->gamma = a->gamma + (b->gamma - a->gamma) * t;
+    out->lift  = a->lift  + (b->lift  - a->lift)  * t;
+    out->gain  = a->gain  + (b->gain  - a->gain)  * t;
+    out->r     = a->r     + (b->r     - a->r)     * t;
+    out->g     = a->g     + (b->g     - a->g)     * t;
+    out->b     = a->b     + (b->b     - a->b)     * t;
+
+    /* A channel override on either side blends against the other's curve */
+    const double sa[3] = { a->gamma, a->lift, a->gain };
+    const double sb[3] = { b->gamma, b->lift, b->gain };
+    memset(out->ch, 0, sizeof(out->ch));
+    out->ch_set = a->ch_set | b->ch_set;
+    for (int f = 0; f < 3; f++) {
+        for (int c = 0; c < 3; c++) {
+            uint64_t bit = 1ull << (3 * f + c);
+            if (!(out->ch_set & bit)) continue;
+            double va = a->ch_set & bit ? a->ch[f][c] : sa[f];
+            double vb = b->ch_set & bit ? b->ch[f][c] : sb[f];
+            out->ch[f][c] = va + (vb - va) * t;
+        }
+    }
+}
+
+/* The preset whose DEGAMMA_LUT and CTM a blend keeps */
+const struct lut_params *blend_color(const struct lut_blend *bl) {
+    return bl->t < 0.5 ? &bl->a : &bl->b;
+}
+
+/* Mix two finished LUTs into out (which may be a): three multiply-adds an
+ * entry, plus a requantize onto the driver's precision when that is below
+ * 16 bits, since a mix of two rounded LUTs is not rounded itself. */
+void blend_lut(const struct drm_color_lut *a, const struct drm_color_lut *b,
+               struct drm_color_lut *out, uint32_t lut_size, double t,
+               uint32_t bits, enum lut_dither dither) {
+    lerp_lut(a, b, out, lut_size, t);
+    if (bits && bits < LUT_BITS_MAX && t > 0.0 && t < 1.0) quantize_lut(out, lut_size, bits, dither);
+}
+
+/* ------------- Fast LUT kernel ------------- */
+
+/* Single-precision variant of build_lut() for LUTs regenerated at display
+ * rate. pow(x, g) is exp2(g * log2(x)) with:
+ *   log2: x = 2^e * m, m in [sqrt(1/2), sqrt(2)), s = (m-1)/(m+1),
+ *         log2(m) = 2/ln2 * (s + s^3/3 + ... + s^9/9)   (|error| < 4e-10)
+ *   exp2: y = n + f, n = round(y), f in [-1/2, 1/2],
+ *         2^f = sum (f ln2)^k / k!, k = 0..7              (rel. error < 6e-9)
+ * so the result is limited by float rounding (~1e-7 relative). After lift,
+ * gain and the channel multipliers this stays within LUT_FAST_MAX_ERR 16-bit
+ * LSBs of build_lut() over the full parameter ranges; `--verify` checks it. */
+
+#define LOG2_C1 2.8853900817779268f  /* 2/ln2 */
+#define LOG2_C3 0.9617966939259756f  /* 2/(3 ln2) */
+#define LOG2_C5 0.5770780163555854f  /* 2/(5 ln2) */
+#define LOG2_C7 0.4121985831111324f  /* 2/(7 ln2) */
+#define LOG2_C9 0.3205988979753252f  /* 2/(9 ln2) */
+#define EXP2_C1 0.6931471805599453f  /* ln2^k / k! */
+#define EXP2_C2 0.2402265069591007f
+#define EXP2_C3 0.0555041086648216f
+#define EXP2_C4 0.0096181291076285f
+#define EXP2_C5 0.0013333558146428f
+#define EXP2_C6 0.0001540353039338f
+#define EXP2_C7 0.0000152527338040f
+
+static inline float fast_log2f(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int32_t e = (int32_t)(bits >> 23) - 127;
+    bits = (bits & 0x007fffffu) | 0x3f800000u;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m > 1.41421356f) { m *= 0.5f; e++; }
+
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float poly = LOG2_C7 + s2 * LOG2_C9;
+    poly = LOG2_C5 + s2 * poly;
+    poly = LOG2_C3 + s2 * poly;
+    poly = LOG2_C1 + s2 * poly;
+    return (float)e + s * poly;
+}
+
+/* y <= 0 here; results below 2^-126 are far under one LSB */
+static inline float fast_exp2f(float y) {
+    if (y < -126.0f) y = -126.0f;
+    float n = floorf(y + 0.5f);
+    float f = y - n;
+    float poly = EXP2_C6 + f * EXP2_C7;
+    poly = EXP2_C5 + f * poly;
+    poly = EXP2_C4 + f * poly;
+    poly = EXP2_C3 + f * poly;
+    poly = EXP2_C2 + f * poly;
+    poly = EXP2_C1 + f * poly;
+    poly = 1.0f + f * poly;
+
+    uint32_t bits = (uint32_t)((int32_t)n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return poly * scale;
+}
+
+static inline uint16_t fast_u16(float v) {
+    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    return (uint16_t)(v * 65535.0f + 0.5f);
+}
+
+/* Portable path, also used for the tail of the NEON loop */
+static void build_lut_fast_scalar(const struct lut_params *p, struct drm_color_lut *lut,
+                                  uint32_t from, uint32_t lut_size) {
+    const float step = 1.0f / (float)(lut_size - 1);
+    struct lut_curve c[3];
+    int same[3];
+    lut_curves(p, c, same);
+    float g[3], lift[3], gain[3], mult[3];
+    for (int k = 0; k < 3; k++) {
+        g[k] = (float)c[k].gamma; lift[k] = (float)c[k].lift;
+        gain[k] = (float)c[k].gain; mult[k] = (float)c[k].mult;
+    }
+
+    for (uint32_t i = from; i < lut_size; i++) {
+        float x = (float)i * step;
+        float lx = x > 0.0f ? fast_log2f(x) : 0.0f;
+        float y[3];
+        for (int k = 0; k < 3; k++) {
+            if (same[k] != k) { y[k] = y[same[k]]; continue; }
+            y[k] = x > 0.0f ? fast_exp2f(g[k] * lx) : 0.0f;
+            y[k] = (y[k] + lift[k]) * gain[k];
+            y[k] = y[k] < 0.0f ? 0.0f : (y[k] > 1.0f ? 1.0f : y[k]);
+        }
+
+        lut[i].red   = fast_u16(y[0] * mult[0]);
+        lut[i].green = fast_u16(y[1] * mult[1]);
+        lut[i].blue  = fast_u16(y[2] * mult[2]);
+        lut[i].reserved = 0;
+    }
+}
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static inline float32x4_t log2_f32x4(float32x4_t x) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    uint32x4_t bits = vreinterpretq_u32_f32(x);
+    int32x4_t e = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127));
+    float32x4_t m = vreinterpretq_f32_u32(
+        vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffffu)), vdupq_n_u32(0x3f800000u)));
+    uint32x4_t big = vcgtq_f32(m, vdupq_n_f32(1.41421356f));
+    m = vbslq_f32(big, vmulq_f32(m, vdupq_n_f32(0.5f)), m);
+    e = vsubq_s32(e, vreinterpretq_s32_u32(big));   /* big lanes are -1 */
+
+    float32x4_t s = vdivq_f32(vsubq_f32(m, one), vaddq_f32(m, one));
+    float32x4_t s2 = vmulq_f32(s, s);
+    float32x4_t poly = vfmaq_f32(vdupq_n_f32(LOG2_C7), s2, vdupq_n_f32(LOG2_C9));
+    poly = vfmaq_f32(vdupq_n_f32(LOG2_C5), s2, poly);
+    poly = vfmaq_f32(vdupq_n_f32(LOG2_C3), s2, poly);
+    poly = vfmaq_f32(vdupq_n_f32(LOG2_C1), s2, poly);
+    return vfmaq_f32(vcvtq_f32_s32(e), s, poly);
+}
+
+static inline float32x4_t exp2_f32x4(float32x4_t y) {
+    y = vmaxq_f32(y, vdupq_n_f32(-126.0f));
+    float32x4_t n = vrndnq_f32(y);
+    float32x4_t f = vsubq_f32(y, n);
+    float32x4_t poly = vfmaq_f32(vdupq_n_f32(EXP2_C6), f, vdupq_n_f32(EXP2_C7));
+    poly = vfmaq_f32(vdupq_n_f32(EXP2_C5), f, poly);
+    poly = vfmaq_f32(vdupq_n_f32(EXP2_C4), f, poly);
+    poly = vfmaq_f32(vdupq_n_f32(EXP2_C3), f, poly);
+    poly = vfmaq_f32(vdupq_n_f32(EXP2_C2), f, poly);
+    poly = vfmaq_f32(vdupq_n_f32(EXP2_C1), f, poly);
+    poly = vfmaq_f32(vdupq_n_f32(1.0f), f, poly);
+
+    int32x4_t ni = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+    float32x4_t scale = vreinterpretq_f32_s32(vshlq_n_s32(ni, 23));
+    return vmulq_f32(poly, scale);
+}
+
+static inline uint16x4_t u16_f32x4(float32x4_t v) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+    v = vfmaq_f32(vdupq_n_f32(0.5f), v, vdupq_n_f32(65535.0f));
+    return vmovn_u32(vcvtq_u32_f32(v));
+}
+
+/* 4 entries per iteration; vst4 interleaves R/G/B/reserved straight into
+ * struct drm_color_lut. */
+void build_lut_fast(const struct lut_params *p, struct drm_color_lut *lut, uint32_t lut_size) {
+    const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+    const float32x4_t step = vdupq_n_f32(1.0f / (float)(lut_size - 1));
+    struct lut_curve c[3];
+    int same[3];
+    lut_curves(p, c, same);
+    float32x4_t g[3], lift[3], gain[3], mult[3];
+    for (int k = 0; k < 3; k++) {
+        g[k] = vdupq_n_f32((float)c[k].gamma);
+        lift[k] = vdupq_n_f32((float)c[k].lift);
+        gain[k] = vdupq_n_f32((float)c[k].gain);
+        mult[k] = vdupq_n_f32((float)c[k].mult);
+    }
+    const float idx0[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t idx = vld1q_f32(idx0);
+
+    uint32_t i = 0;
+    for (; i + 4 <= lut_size; i += 4) {
+        float32x4_t x = vmulq_f32(idx, step);
+        float32x4_t lx = log2_f32x4(x);
+        uint32x4_t x0 = vceqq_f32(x, zero);
+        float32x4_t y[3];
+        for (int k = 0; k < 3; k++) {
+            if (same[k] != k) { y[k] = y[same[k]]; continue; }
+            y[k] = exp2_f32x4(vmulq_f32(g[k], lx));
+            y[k] = vbslq_f32(x0, zero, y[k]);           /* pow(0, g) = 0 */
+            y[k] = vmulq_f32(vaddq_f32(y[k], lift[k]), gain[k]);
+            y[k] = vminq_f32(vmaxq_f32(y[k], zero), one);
+        }
+
+        uint16x4x4_t out;
+        out.val[0] = u16_f32x4(vmulq_f32(y[0], mult[0]));
+        out.val[1] = u16_f32x4(vmulq_f32(y[1], mult[1]));
+        out.val[2] = u16_f32x4(vmulq_f32(y[2], mult[2]));
+        out.val[3] = vdup_n_u16(0);
+        vst4_u16(&lut[i].red, out);
+        idx = vaddq_f32(idx, vdupq_n_f32(4.0f));
+    }
+    build_lut_fast_scalar(p, lut, i, lut_size);
+}
+
+#else
+
+void build_lut_fast(const struct lut_params *p, struct drm_color_lut *lut, uint32_t lut_size) {
+    build_lut_fast_scalar(p, lut, 0, lut_size);
+}
+
+#endif
+
+void build_lut_kernel(enum lut_kernel kernel, const struct lut_params *p,
+                      struct drm_color_lut *lut, uint32_t lut_size) {
+    if (kernel == LUT_KERNEL_FAST) build_lut_fast(p, lut, lut_size);
+    else build_lut(p, lut, lut_size);
+}
+
+bool ctm_set(const struct lut_params *p) {
+    static const double zero[9];
+    return memcmp(p->ctm, zero, sizeof(zero)) != 0;
+}
+
+/* DEGAMMA_LUT = x^degamma */
+void build_degamma(const struct lut_params *p, struct drm_color_lut *lut, uint32_t size) {
+    struct lut_params dp = { .gamma = p->degamma, .gain = 1.0, .r = 1.0, .g = 1.0, .b = 1.0 };
+    build_lut(&dp, lut, size);
+}
+
+/* S31.32 sign-magnitude */
+void build_ctm(const struct lut_params *p, struct drm_color_ctm *m) {
+    for (int i = 0; i < 9; i++) {
+        m->matrix[i] = (uint64_t)llround(fabs(p->ctm[i]) * 4294967296.0);
+        if (p->ctm[i] < 0) m->matrix[i] |= 1ull << 63;
+    }
+}
+
+/* Whether blob_id holds exactly these len bytes */
+static bool blob_matches(int fd, uint32_t blob_id, const void *data, size_t len) {
+    void *buf = scratch(SCRATCH_BLOB, len);
+    return buf && blob_read(fd, blob_id, buf, len) && !memcmp(buf, data, len);
+}
+
+/* Whether the CRTC already shows lut (GAMMA_LUT 0 counts as identity) and,
+ * with color, p's DEGAMMA_LUT and CTM, judged by the blob values in ci.
+ * A legacy CRTC's ramp is read back from the kernel. */
+bool crtc_shows(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+                const struct lut_params *color) {
+    size_t len = sizeof(*lut) * ci->lut_size;
+    if (ci->legacy) {
+        struct drm_color_lut *cur = scratch(SCRATCH_SHOWN, len);
+        if (!cur || legacy_get_lut(fd, ci, cur) || memcmp(cur, lut, len)) return false;
+    } else if (ci->lut_blob) {
+        if (!blob_matches(fd, ci->lut_blob, lut, len)) return false;
+    } else {
+        struct drm_color_lut *id = scratch(SCRATCH_SHOWN, len);
+        if (!id) return false;
+        identity_lut(id, ci->lut_size);
+        if (memcmp(id, lut, len)) return false;
+    }
+    if (!color) return true;
+
+    if (ci->degamma_prop) {
+        if (!color->degamma) {
+            if (ci->degamma_blob) return false;
+        } else {
+            struct drm_color_lut *dl = scratch(SCRATCH_SHOWN, sizeof(*dl) * ci->degamma_size);
+            if (!dl) return false;
+            build_degamma(color, dl, ci->degamma_size);
+            if (!blob_matches(fd, ci->degamma_blob, dl, sizeof(*dl) * ci->degamma_size)) return false;
+        }
+    }
+    if (ci->ctm_prop) {
+        if (!ctm_set(color)) return !ci->ctm_blob;
+        struct drm_color_ctm m;
+        build_ctm(color, &m);
+        return blob_matches(fd, ci->ctm_blob, &m, sizeof(m));
+    }
+    return true;
+}
+
+/* Legacy CRTC: lut, else the contents of blob_id, else identity (what
+ * GAMMA_LUT 0 means). return: 0, or the ioctl's error (reported) */
+int legacy_commit(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+                  uint32_t blob_id) {
+    if (!lut) {
+        size_t len = sizeof(*lut) * ci->lut_size;
+        struct drm_color_lut *buf = scratch(SCRATCH_BLOB, len);
+        if (!buf) { perror("realloc(lut)"); return -1; }
+        if (!blob_read(fd, blob_id, buf, len)) identity_lut(buf, ci->lut_size);
+        lut = buf;
+    }
+    int ret = legacy_set_lut(fd, ci, lut);
+    if (ret) fprintf(stderr, "drmModeCrtcSetGamma(%u): %s\n", ci->crtc_id, strerror(-ret));
+    return ret;
+}
+
+/* DEGAMMA_LUT and CTM for p, as one-off blobs (0 = bypass) added to req.
+ * A CRTC without the property only gets a warning when p uses it. */
+static int add_color_props(int fd, struct atomic_req *req, const struct crtc_info *ci,
+                           const struct lut_params *p, uint32_t *own, int *nown) {
+    int ret = 0;
+    if (ci->degamma_prop) {
+        uint32_t id = 0;
+        if (p->degamma) {
+            struct drm_color_lut *lut = scratch(SCRATCH_DEGAMMA, sizeof(*lut) * ci->degamma_size);
+            if (!lut) { perror("realloc(lut)"); return -1; }
+            build_degamma(p, lut, ci->degamma_size);
+            ret = create_blob(fd, lut, sizeof(*lut) * ci->degamma_size, &id);
+            if (ret) { perror("drmModeCreatePropertyBlob(DEGAMMA_LUT)"); return ret; }
+            own[(*nown)++] = id;
+        }
+        ret = atomic_add(req, ci->crtc_id, ci->degamma_prop, id);
+        if (ret) { fprintf(stderr, "atomic_add failed: %d\n", ret); return ret; }
+    } else if (p->degamma) {
+        fprintf(stderr, "CRTC %u has no DEGAMMA_LUT; ignoring degamma.\n", ci->crtc_id);
+    }
+
+    bool ctm = ctm_set(p);
+    if (ci->ctm_prop) {
+        uint32_t id = 0;
+        if (ctm) {
+            struct drm_color_ctm m;
+            build_ctm(p, &m);
+            ret = create_blob(fd, &m, sizeof(m), &id);
+            if (ret) { perror("drmModeCreatePropertyBlob(CTM)"); return ret; }
+            own[(*nown)++] = id;
+        }
+        ret = atomic_add(req, ci->crtc_id, ci->ctm_prop, id);
+        if (ret) { fprintf(stderr, "atomic_add failed: %d\n", ret); return ret; }
+    } else if (ctm) {
+        fprintf(stderr, "CRTC %u has no CTM; ignoring ctm.\n", ci->crtc_id);
+    }
+    return 0;
+}
+
+/* Set GAMMA_LUT on n CRTCs in one atomic commit, so they all switch on the
+ * same frame. CRTC k gets blob_ids[k] when that is non-zero (or luts is
+ * NULL), else a one-off blob made from luts[k]; CRTCs passed the same LUT
+ * pointer share it, and it is destroyed after the commit (the kernel keeps
+ * its own reference). When color[k] is set, CRTC k's DEGAMMA_LUT and CTM
+ * are set from it in the same commit (color NULL leaves them alone).
+ * flags/user_data are passed to the atomic commit; with
+ * DRM_MODE_PAGE_FLIP_EVENT every CRTC sends its own event. Legacy CRTCs
+ * are set with drmModeCrtcSetGamma() right after the commit (from luts[k],
+ * else blob_ids[k]'s contents, else identity) and send no event. */
+int commit_gamma(int fd, const struct crtc_info *const *ci,
+                 const struct drm_color_lut *const *luts, const uint32_t *blob_ids,
+                 const struct lut_params *const *color,
+                 int n, uint32_t flags, void *user_data) {
+    const struct drm_color_lut *src[MAX_CRTCS];
+    uint32_t ids[MAX_CRTCS], own[3 * MAX_CRTCS];
+    int nown = 0, ret = 0;
+    struct atomic_req req = { 0 };
+
+    int natomic = 0;
+    for (int k = 0; k < n && !ret; k++) {
+        ids[k] = blob_ids ? blob_ids[k] : 0;
+        if (ci[k]->legacy) {
+            src[k] = luts ? luts[k] : NULL;
+            if (color && color[k]) ret = add_color_props(fd, &req, ci[k], color[k], own, &nown);
+            continue;
+        }
+        src[k] = ids[k] || !luts ? NULL : luts[k];
+        for (int j = 0; j < k && src[k] && !ids[k]; j++) {
+            if (src[j] == src[k] && !ci[j]->legacy) ids[k] = ids[j];
+        }
+        if (src[k] && !ids[k]) {
+            ret = create_blob(fd, src[k], sizeof(*src[k]) * ci[k]->lut_size, &ids[k]);
+            if (ret) { perror("drmModeCreatePropertyBlob"); break; }
+            own[nown++] = ids[k];
+        }
+        ret = atomic_add(&req, ci[k]->crtc_id, ci[k]->lut_prop, ids[k]);
+        if (ret) fprintf(stderr, "atomic_add failed: %d\n", ret);
+        else ret = color && color[k] ? add_color_props(fd, &req, ci[k], color[k], own, &nown) : 0;
+        natomic++;
+    }
+
+    if (!ret) {
+        uint64_t t0 = now_ns();
+        if (natomic) {
+            ret = atomic_commit(fd, &req, flags, user_data);
+            if (ret) perror("atomic commit");
+        }
+        for (int k = 0; k < n && !ret && !(flags & DRM_MODE_ATOMIC_TEST_ONLY); k++) {
+            if (ci[k]->legacy) ret = legacy_commit(fd, ci[k], src[k], ids[k]);
+        }
+        if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+            stats_observe(&g_stats.commit, now_ns() - t0);
+            stats_commit_done(ret);
+        }
+    }
+
+    for (int k = 0; k < nown; k++) drmModeDestroyPropertyBlob(fd, own[k]);
+    return ret;
+}
+
+/* Point GAMMA_LUT at an existing blob: a single atomic property set */
+int commit_blob(int fd, const struct crtc_info *ci, uint32_t blob_id,
+                uint32_t flags, void *user_data) {
+    return commit_gamma(fd, &ci, NULL, &blob_id, NULL, 1, flags, user_data);
+}
+
+/* One-off blob: create, commit, destroy */
+int commit_lut(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+               uint32_t flags, void *user_data) {
+    return commit_gamma(fd, &ci, &lut, NULL, NULL, 1, flags, user_data);
+}
+
+/* commit_gamma() as DRM master, dropped again right after, so that a
+ * compositor or kmssink started later can still take it. That is two more
+ * ioctls per commit, timed in g_stats.master.
+ * return: as commit_gamma(), -EACCES if another client holds master */
+int commit_gamma_master(int fd, const struct crtc_info *const *ci,
+                        const struct drm_color_lut *const *luts, const uint32_t *blob_ids,
+                        const struct lut_params *const *color,
+                        int n, uint32_t flags, void *user_data) {
+    uint64_t t0 = now_ns();
+    if (drmSetMaster(fd)) {
+        fprintf(stderr, "Not DRM master: %s (another client, such as a compositor, holds it)\n",
+                strerror(errno));
+        g_stats.fail_master++;
+        return -EACCES;
+    }
+    uint64_t t1 = now_ns();
+    int ret = commit_gamma(fd, ci, luts, blob_ids, color, n, flags, user_data);
+    uint64_t t2 = now_ns();
+    drmDropMaster(fd);
+    stats_observe(&g_stats.master, (t1 - t0) + (now_ns() - t2));
+    return ret;
+}
+
+/* --------------- Topology --------------- */
+
+#define TOPOLOGY_VERSION 3
+#define MAX_CARDS        8
+
+/* Drivers known to use fewer than 16 bits of each GAMMA_LUT entry */
+static const struct { const char *driver; uint32_t bits; } lut_driver_bits[] = {
+    { "rockchip", 10 },          /* VOP2 gamma LUT: 10 bits per channel */
+};
+
+/* On-disk cache: header + struct topology */
+struct topology_hdr {
+    char magic[4];                      /* "GTOP" */
+    uint32_t version;
+    uint32_t size;                      /* sizeof(struct topology) */
+};
+
+static const char *connector_type_name(uint32_t type) {
+    static const char *const names[] = {
+        "Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO", "LVDS",
+        "Component", "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP", "Virtual",
+        "DSI", "DPI", "Writeback", "SPI", "USB",
+    };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "Unknown";
+}
+
+/* Uses drmModeGetConnectorCurrent(): a forced connector probe can take
+ * milliseconds (DDC reads), and the current state is what matters here. */
+static void scan_outputs(int fd, const drmModeRes *res, struct topology *t) {
+    for (int i = 0; i < res->count_connectors && t->nout < MAX_OUTPUTS; i++) {
+        drmModeConnector *c = drmModeGetConnectorCurrent(fd, res->connectors[i]);
+        if (!c) continue;
+        drmModeEncoder *e = c->connection == DRM_MODE_CONNECTED && c->encoder_id
+                          ? drmModeGetEncoder(fd, c->encoder_id) : NULL;
+        if (e && e->crtc_id) {
+            struct output *o = &t->out[t->nout++];
+            snprintf(o->name, sizeof(o->name), "%s-%u",
+                     connector_type_name(c->connector_type), c->connector_type_id);
+            o->conn_id = c->connector_id;
+            o->crtc_id = e->crtc_id;
+        }
+        if (e) drmModeFreeEncoder(e);
+        drmModeFreeConnector(c);
+    }
+}
+
+static uint32_t driver_lut_bits(int fd) {
+    uint32_t bits = LUT_BITS_MAX;
+    drmVersion *v = drmGetVersion(fd);
+    for (size_t k = 0; v && v->name && k < sizeof(lut_driver_bits) / sizeof(lut_driver_bits[0]); k++) {
+        if (!strcmp(v->name, lut_driver_bits[k].driver)) bits = lut_driver_bits[k].bits;
+    }
+    if (v) drmFreeVersion(v);
+    return bits;
+}
+
+int scan_topology(int fd, const char *card, struct topology *t) {
+    drmModeRes *res = drmModeGetResources(fd);
+    if (!res) return -1;
+
+    memset(t, 0, sizeof(*t));
+    snprintf(t->card, sizeof(t->card), "%s", card);
+    for (int i = 0; i < res->count_crtcs && t->ncrtc < MAX_CRTCS; i++) {
+        struct crtc_info *ci = &t->crtc[t->ncrtc];
+        if (read_crtc_props(fd, res->crtcs[i], ci) == 0 && (ci->lut_prop || ci->legacy)) t->ncrtc++;
+    }
+    scan_outputs(fd, res, t);
+    drmModeFreeResources(res);
+    t->lut_bits = driver_lut_bits(fd);
+    return 0;
+}
+
+/* Atomic support is detected here, once per card; a driver without it is
+ * still used, through the legacy gamma ioctl (see g_atomic). */
+int open_card_path(const char *path) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+    g_atomic = drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+    return fd;
+}
+
+/* Try every /dev/dri/cardN: render-only GPUs (panfrost, ...) also show up
+ * as cards, and the display controller is not always card0. */
+static int discover_card(struct topology *t) {
+    int err = ENOENT;
+    for (int card = 0; card < MAX_CARDS; card++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/dri/card%d", card);
+        int fd = open_card_path(path);
+        if (fd < 0) {
+            if (errno != ENOENT) err = errno;
+            continue;
+        }
+        if (scan_topology(fd, path, t) == 0 && t->ncrtc > 0) return fd;
+        close(fd);
+        err = 0;
+    }
+    if (err) fprintf(stderr, "open /dev/dri/cardN: %s\n", strerror(err));
+    else fprintf(stderr, "No DRM card with a GAMMA_LUT or legacy gamma ramp found\n");
+    return -1;
+}
+
+static bool topology_load(const char *path, struct topology *t) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct topology_hdr h;
+    struct iovec iov[2] = {
+        { .iov_base = &h, .iov_len = sizeof(h) },
+        { .iov_base = t, .iov_len = sizeof(*t) },
+    };
+    ssize_t n = readv(fd, iov, 2);
+    close(fd);
+    return n == (ssize_t)(iov[0].iov_len + iov[1].iov_len) &&
+           !memcmp(h.magic, "GTOP", 4) && h.version == TOPOLOGY_VERSION &&
+           h.size == sizeof(*t) && t->ncrtc > 0 && t->ncrtc <= MAX_CRTCS &&
+           t->nout >= 0 && t->nout <= MAX_OUTPUTS &&
+           memchr(t->card, '\0', sizeof(t->card));
+}
+
+/* Best effort, like lut_cache_store() */
+void topology_store(const char *path, const struct topology *t) {
+    char tmp[PATH_MAX];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= sizeof(tmp)) return;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    struct topology_hdr h = {
+        .magic = { 'G', 'T', 'O', 'P' },
+        .version = TOPOLOGY_VERSION,
+        .size = sizeof(*t),
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &h, .iov_len = sizeof(h) },
+        { .iov_base = (void *)t, .iov_len = sizeof(*t) },
+    };
+    ssize_t n = writev(fd, iov, 2);
+    if (close(fd) == 0 && n == (ssize_t)(iov[0].iov_len + iov[1].iov_len)) {
+        if (rename(tmp, path) == 0) return;
+    }
+    unlink(tmp);
+}
+
+#ifdef BOARD_CARD
+_Static_assert(sizeof(BOARD_CARD) <= sizeof(((struct topology *)0)->card), "BOARD_CARD too long");
+_Static_assert(sizeof((uint32_t[]){ BOARD_PROPS }) == CP_COUNT * sizeof(uint32_t),
+               "BOARD_PROPS takes the IDs of GAMMA_LUT, GAMMA_LUT_SIZE, DEGAMMA_LUT, "
+               "DEGAMMA_LUT_SIZE, CTM and ACTIVE (0 = absent)");
+
+/* The board's CRTC, if it still has the compiled-in property IDs and LUT
+ * size: one property read and one name check, instead of a lookup of every
+ * property by name. return: 0, -1 if the card does not match */
+static int board_crtc(int fd, struct crtc_info *ci) {
+    static const uint32_t want[CP_COUNT] = { BOARD_PROPS };
+    drmModeObjectProperties *props =
+        drmModeObjectGetProperties(fd, DEFAULT_CRTC, DRM_MODE_OBJECT_CRTC);
+    if (!props) return -1;
+
+    uint32_t id[CP_COUNT] = { 0 };
+    uint64_t val[CP_COUNT] = { [CP_GAMMA_LUT_SIZE] = 256, [CP_ACTIVE] = 1 };
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        for (int k = 0; k < CP_COUNT; k++) {
+            if (!want[k] || props->props[i] != want[k]) continue;
+            id[k] = want[k];
+            val[k] = props->prop_values[i];
+        }
+    }
+    drmModeFreeObjectProperties(props);
+    if (!want[CP_GAMMA_LUT] || memcmp(id, want, sizeof(id)) || val[CP_GAMMA_LUT_SIZE] != BOARD_LUT_SIZE) {
+        return -1;
+    }
+
+    drmModePropertyRes *p = drmModeGetProperty(fd, want[CP_GAMMA_LUT]);
+    bool ok = p && !strcmp(p->name, "GAMMA_LUT");
+    if (p) drmModeFreeProperty(p);
+    if (!ok) return -1;
+    crtc_info_set(ci, DEFAULT_CRTC, id, val);
+    return 0;
+}
+
+/* Board build (make BOARD_CARD=... BOARD_LUT_SIZE=... BOARD_PROPS=..., see
+ * --board-profile): t holds just the board's CRTC, with no discovery, no
+ * outputs and no cache file. return: DRM fd, -1 if the board differs */
+int board_topology(struct topology *t) {
+    int fd = open_card_path(BOARD_CARD);
+    if (fd < 0) return -1;
+    memset(t, 0, sizeof(*t));
+    snprintf(t->card, sizeof(t->card), "%s", BOARD_CARD);
+    if (!g_atomic || board_crtc(fd, &t->crtc[0])) {
+        close(fd);
+        return -1;
+    }
+    t->ncrtc = 1;
+#ifdef BOARD_LUT_BITS
+    t->lut_bits = BOARD_LUT_BITS;
+#else
+    t->lut_bits = driver_lut_bits(fd);
+#endif
+    t->board = true;
+    return fd;
+}
+#else
+int board_topology(struct topology *t) { return -1; }  /* not a board build */
+#endif
+
+/* Open the display card and fill in t, from the board profile (when board
+ * is set and the card matches it) or the cache when one is given and valid
+ * (no scan at all), else by discovery, which then refreshes the cache.
+ * Cached GAMMA_LUT values (lut_blob) are stale; re-read them when needed.
+ * return: DRM fd or -1 */
+int open_topology(struct topology *t, const char *cache, bool board) {
+    int bfd = board ? board_topology(t) : -1;
+    if (bfd >= 0) return bfd;
+    if (cache && topology_load(cache, t)) {
+        int fd = open_card_path(t->card);
+        if (fd >= 0) {
+            t->cached = true;
+            return fd;
+        }
+    }
+    int fd = discover_card(t);
+    if (fd >= 0 && cache) topology_store(cache, t);
+    return fd;
+}
+
+const struct crtc_info *topology_crtc(const struct topology *t, uint32_t crtc_id) {
+    for (int k = 0; k < t->ncrtc; k++) {
+        if (t->crtc[k].crtc_id == crtc_id) return &t->crtc[k];
+    }
+    return NULL;
+}
+
+/* --------------- LUT cache --------------- */
+
+/* Bump whenever a kernel's output changes for the same parameters, or the
+ * file header does. */
+#define LUT_CACHE_VERSION 3
+
+/* On-disk entry: <dir>/<key>-<lut_size>.lut = header + lut_size entries */
+struct lut_file_hdr {
+    char magic[4];               /* "GLUT" */
+    uint32_t version;
+    uint32_t lut_size;
+    uint16_t params_size;        /* sizeof(struct lut_params) */
+    uint16_t kernel;             /* lut_variant() */
+    uint64_t sum;                /* lut_sum() of the entries */
+    struct lut_params params;
+};
+
+/* Everything besides the params that shapes a LUT: the kernel, and the
+ * depth and dither when entries are requantized (full-precision LUTs keep
+ * the plain kernel id, so their cache entries stay valid). */
+uint32_t lut_variant(const struct lut_opts *lo) {
+    if (!lo->bits || lo->bits >= LUT_BITS_MAX) return (uint32_t)lo->kernel;
+    return (uint32_t)lo->kernel | (uint32_t)lo->dither << 4 | lo->bits << 8;
+}
+
+/* The selected kernel, then requantized to the effective depth */
+void build_lut_opts(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size) {
+    build_lut_kernel(lo->kernel, p, lut, lut_size);
+    if (lo->bits && lo->bits < LUT_BITS_MAX && !params_identity(p)) {
+        quantize_lut(lut, lut_size, lo->bits, lo->dither);
+    }
+}
+
+static uint64_t fnv1a64(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t lut_key(const struct lut_params *p, uint32_t lut_size, uint32_t variant) {
+    uint32_t v[3] = { LUT_CACHE_VERSION, lut_size, variant };
+    uint64_t h = fnv1a64(0xcbf29ce484222325ull, v, sizeof(v));
+    return fnv1a64(h, p, sizeof(*p));
+}
+
+/* What a LUT holds, as opposed to lut_key(), which is what it was built
+ * from; --dump identifies a LUT read back from the CRTC by this. */
+uint64_t lut_sum(const struct drm_color_lut *lut, uint32_t lut_size) {
+    return fnv1a64(0xcbf29ce484222325ull, lut, sizeof(*lut) * lut_size);
+}
+
+static void lut_cache_path(char *buf, size_t len, const struct lut_opts *lo,
+                           const struct lut_params *p, uint32_t lut_size) {
+    snprintf(buf, len, "%s/%016llx-%u.lut", lo->cache_dir,
+             (unsigned long long)lut_key(p, lut_size, lut_variant(lo)), lut_size);
+}
+
+static bool lut_hdr_matches(const struct lut_file_hdr *h, const struct lut_opts *lo,
+                            const struct lut_params *p, uint32_t lut_size) {
+    return !memcmp(h->magic, "GLUT", 4) && h->version == LUT_CACHE_VERSION &&
+           h->lut_size == lut_size && h->params_size == sizeof(*p) &&
+           h->kernel == lut_variant(lo) && !memcmp(&h->params, p, sizeof(*p));
+}
+
+/* One readv() straight into the caller's buffer; the header must match.
+ * lut may be NULL to read just the header's sum. */
+bool lut_cache_read(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size, uint64_t *sum) {
+    char path[PATH_MAX];
+    lut_cache_path(path, sizeof(path), lo, p, lut_size);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct lut_file_hdr h;
+    struct iovec iov[2] = {
+        { .iov_base = &h, .iov_len = sizeof(h) },
+        { .iov_base = lut, .iov_len = lut ? sizeof(*lut) * lut_size : 0 },
+    };
+    ssize_t n = readv(fd, iov, lut ? 2 : 1);
+    close(fd);
+    if (n != (ssize_t)(iov[0].iov_len + iov[1].iov_len) || !lut_hdr_matches(&h, lo, p, lut_size)) {
+        return false;
+    }
+    if (sum) *sum = h.sum;
+    return true;
+}
+
+bool lut_cache_load(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size) {
+    return lut_cache_read(lo, p, lut, lut_size, NULL);
+}
+
+/* Best effort: a read-only or missing cache directory just means no cache. */
+void lut_cache_store(const struct lut_opts *lo, const struct lut_params *p,
+                     const struct drm_color_lut *lut, uint32_t lut_size) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    lut_cache_path(path, sizeof(path), lo, p, lut_size);
+    /* Unique per call: daemon warm-up workers store concurrently */
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) return;
+
+    if (mkdir(lo->cache_dir, 0755) < 0 && errno != EEXIST) return;
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) return;
+    if (fchmod(fd, 0644) < 0) { /* stays private to this user; still a valid cache entry */ }
+
+    struct lut_file_hdr h = {
+        .magic = { 'G', 'L', 'U', 'T' },
+        .version = LUT_CACHE_VERSION,
+        .lut_size = lut_size,
+        .params_size = sizeof(*p),
+        .kernel = (uint16_t)lut_variant(lo),
+        .sum = lut_sum(lut, lut_size),
+        .params = *p,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &h, .iov_len = sizeof(h) },
+        { .iov_base = (void *)lut, .iov_len = sizeof(*lut) * lut_size },
+    };
+    ssize_t n = writev(fd, iov, 2);
+    if (close(fd) == 0 && n == (ssize_t)(iov[0].iov_len + iov[1].iov_len)) {
+        if (rename(tmp, path) == 0) return;
+    }
+    unlink(tmp);
+}
+
+/* A LUT prebuilt in any preset database opened so far; *data points at its
+ * entries in the mapping. */
+const struct preset_db_lut *preset_db_lut_find(const struct lut_opts *lo,
+                                               const struct lut_params *p, uint32_t lut_size,
+                                               const void **data) {
+    uint64_t key = lut_key(p, lut_size, lut_variant(lo));
+    size_t bytes = sizeof(struct drm_color_lut) * lut_size;
+    for (int i = 0; i < ini_nfiles; i++) {
+        const struct ini_file *f = &ini_files[i];
+        const struct preset_db_hdr *h = f->db;
+        if (!h || !h->nluts || h->lut_entry_size != sizeof(struct preset_db_lut) ||
+            h->luts_off % 8 || h->luts_off > f->len ||
+            (uint64_t)h->nluts * sizeof(struct preset_db_lut) > f->len - h->luts_off) {
+            continue;
+        }
+        const struct preset_db_lut *t = (const void *)(f->map + h->luts_off);
+        uint32_t lo_i = 0, hi_i = h->nluts;
+        while (lo_i < hi_i) {
+            uint32_t mid = lo_i + (hi_i - lo_i) / 2;
+            if (t[mid].key < key) lo_i = mid + 1;
+            else hi_i = mid;
+        }
+        for (; lo_i < h->nluts && t[lo_i].key == key; lo_i++) {
+            const struct preset_db_lut *e = &t[lo_i];
+            if (e->lut_size != lut_size || e->kernel != lut_variant(lo) ||
+                memcmp(&e->params, p, sizeof(*p)) || e->off % 2 || e->off > f->len ||
+                bytes > f->len - e->off) {
+                continue;
+            }
+            *data = f->map + e->off;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+bool preset_db_lut_load(const struct lut_opts *lo, const struct lut_params *p,
+                        struct drm_color_lut *lut, uint32_t lut_size) {
+    const void *data;
+    if (!preset_db_lut_find(lo, p, lut_size, &data)) return false;
+    memcpy(lut, data, sizeof(*lut) * lut_size);
+    return true;
+}
+
+/* ----------------- Params ----------------- */
+
+/* Apply a loaded preset on top of the defaults. return: false without gamma */
+bool preset_to_params(const struct preset_vals *pv, struct lut_params *p) {
+    *p = (struct lut_params){ .gamma = 1.0, .gain = 1.0, .r = 1.0, .g = 1.0, .b = 1.0 };
+    /* gamma may be left out only when every channel has its own */
+    if (!pv->have_gamma && !(pv->have_ch[0][0] && pv->have_ch[0][1] && pv->have_ch[0][2])) return false;
+    if (pv->have_gamma) p->gamma = pv->gamma;
+    if (pv->have_lift) p->lift = pv->lift;
+    if (pv->have_gain) p->gain = pv->gain;
+    if (pv->have_r)    p->r = pv->r;
+    if (pv->have_g)    p->g = pv->g;
+    if (pv->have_b)    p->b = pv->b;
+    if (pv->have_degamma) p->degamma = pv->degamma;
+    if (pv->have_ctm)  memcpy(p->ctm, pv->ctm, sizeof(p->ctm));
+    for (int f = 0; f < 3; f++) {
+        for (int c = 0; c < 3; c++) {
+            if (!pv->have_ch[f][c]) continue;
+            p->ch[f][c] = pv->ch[f][c];
+            p->ch_set |= 1ull << (3 * f + c);
+        }
+    }
+    return true;
+}
+
+/* v = gamma lift gain r g b (a --shm entry, gamma_curve()), range-checked
+ * like a request's. */
+bool shm_params(const double *v, struct lut_params *p) {
+    *p = (struct lut_params){ .gamma = v[0], .lift = v[1], .gain = v[2], .r = v[3], .g = v[4], .b = v[5] };
+    return v[0] >= GAMMA_MIN && v[0] <= GAMMA_MAX && v[1] >= LIFT_MIN && v[1] <= LIFT_MAX &&
+           v[2] >= GAIN_MIN && v[2] <= GAIN_MAX && v[3] >= MULT_MIN && v[3] <= MULT_MAX &&
+           v[4] >= MULT_MIN && v[4] <= MULT_MAX && v[5] >= MULT_MIN && v[5] <= MULT_MAX;
+}
@@ -0,0 +1,419 @@
+// gamma-core.h — the core shared by gamma and libgamma (internal)
+//
+// Presets, LUT building, the DRM commit path, topology and the LUT caches,
+// as implemented in gamma-core.c. gamma.c adds the command line and daemon
+// on top, libgamma.c the public API of libgamma.h. Not installed.
+
+#ifndef GAMMA_CORE_H
+#define GAMMA_CORE_H
+
+#ifndef DEFAULT_CRTC
+#define DEFAULT_CRTC 68
+#endif
+
+#ifndef LUT_CACHE_DIR
+#define LUT_CACHE_DIR "/var/cache/gamma"
+#endif
+
+/* tmpfs, so a reboot (possibly into a kernel with other object IDs) rescans */
+#ifndef TOPOLOGY_CACHE
+#define TOPOLOGY_CACHE "/run/gamma-topology"
+#endif
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm/drm_mode.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Board build with BOARD_PRESETS: that file's compiled database, as
+ * generated by gamma --compile <ini> -o gamma-board.h, is first in the
+ * preset search path under this name. */
+#ifdef BOARD_DB
+#define BOARD_DB_PATH "<built-in>"
+#define BOARD_DB_USAGE "  " BOARD_DB_PATH " (compiled in)\n"
+#else
+#define BOARD_DB_USAGE ""
+#endif
+
+/* Some systems don’t expose O_CLOEXEC unless _GNU_SOURCE; add fallback */
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* Safe bounds to avoid black/white screens */
+#define GAMMA_MIN 0.10
+#define GAMMA_MAX 5.00
+#define LIFT_MIN  -1.00
+#define LIFT_MAX   1.00
+#define GAIN_MIN   0.00
+#define GAIN_MAX  10.00
+#define MULT_MIN   0.00
+#define MULT_MAX   4.00
+#define CTM_MIN   -4.00
+#define CTM_MAX    4.00
+
+/* ----------------- Helpers ----------------- */
+
+static inline uint16_t u16clamp(double x) {
+    if (x < 0.0) return 0;
+    if (x > 65535.0) return 65535;
+    return (uint16_t)(x + 0.5);
+}
+
+bool parse_uint32(const char *s, uint32_t *out);
+bool parse_double_strict(const char *s, double *out);
+bool parse_double_in_range(const char *label, const char *s,
+                           double minv, double maxv, double *out);
+
+/* -------------- INI handling -------------- */
+
+struct preset_vals {
+    bool have_gamma, have_lift, have_gain, have_r, have_g, have_b;
+    double gamma, lift, gain, r, g, b;
+    bool have_degamma, have_ctm;
+    double degamma, ctm[9];
+    bool have_ch[3][3];          /* gamma_r .. gain_b, see ch_keys */
+    double ch[3][3];
+    bool have_crtc;
+    uint32_t crtc;
+};
+
+/* Each preset file is mapped and indexed once per process (ini_open());
+ * every lookup after that walks the index, never the text. Keys, values and
+ * section names are spans into the read-only mapping. */
+struct ini_span {
+    const char *p;
+    size_t len;
+};
+
+struct ini_entry {
+    struct ini_span key, val;
+};
+
+struct ini_section {
+    struct ini_span name;
+    int first, count;            /* range in ini_file.ent */
+};
+
+/* Compiled preset database (gamma --compile), used in place from the
+ * mapping: presets sorted by name for a binary search, their source order
+ * for --list, a NUL-terminated name pool and optional prebuilt LUTs (see
+ * struct preset_db_lut). Values were validated when compiling. Native byte
+ * order and layout; the size fields reject a file from another build.
+ * Offsets are from the start of the file. */
+#define PRESET_DB_VERSION 2
+
+struct preset_db_hdr {
+    char magic[4];               /* "GPDB" */
+    uint32_t version;
+    uint32_t vals_size;          /* sizeof(struct preset_vals) */
+    uint32_t lut_entry_size;     /* sizeof(struct preset_db_lut) */
+    uint32_t count;              /* presets */
+    uint32_t nluts;              /* prebuilt LUTs */
+    uint32_t has_config;         /* [config] crtc */
+    uint32_t config_crtc;
+    uint64_t entries_off;        /* struct preset_db_entry[count], by name */
+    uint64_t order_off;          /* uint32_t[count]: entry index, source order */
+    uint64_t names_off, names_len;
+    uint64_t luts_off;           /* struct preset_db_lut[nluts], by key */
+};
+
+struct preset_db_entry {
+    uint32_t name_off;           /* into the name pool */
+    uint32_t reserved;
+    struct preset_vals vals;
+};
+
+struct ini_file {
+    char path[PATH_MAX];
+    bool present;                /* the file exists and was readable */
+    const char *map;
+    size_t len;
+    const struct preset_db_hdr *db;  /* the mapping is a compiled database */
+    int nsec, nent;
+    struct ini_section *sec;
+    struct ini_entry *ent;
+};
+
+#define INI_NAME_MAX    255      /* longer section names are truncated */
+
+typedef void (*preset_fn)(const char *name, void *ctx);
+
+extern const char *const ch_keys[3][3];
+
+bool span_eq(struct ini_span s, const char *str);
+void span_str(struct ini_span s, char *buf, size_t size);
+bool ini_index(struct ini_file *f);
+bool db_valid(const char *map, size_t len);
+void ini_map(struct ini_file *f, const char *path);
+void ini_unmap(struct ini_file *f);
+bool db_sibling(const char *path, char *buf, size_t size);
+const struct ini_file *ini_open(const char *path);
+void ini_drop(const char *path);
+void ini_reset(void);
+int scan_presets_from_file(const char *path, preset_fn fn, void *ctx);
+int index_preset(const struct ini_file *f, const char *want, struct preset_vals *pv);
+int index_config_crtc(const struct ini_file *f, uint32_t *out_crtc);
+int load_config_crtc(const char *preset_path, uint32_t *out_crtc);
+int load_preset(const char *name, const char *preset_path, struct preset_vals *pv);
+void foreach_preset(const char *preset_path, preset_fn fn, void *ctx);
+void list_all_presets(const char *preset_path);
+
+/* ----------------- Stats ----------------- */
+
+/* Counters and latency histograms of the apply pipeline, kept by every
+ * mode but only reported by the daemon (--stats). Buckets are upper bounds
+ * in microseconds; the last one catches everything slower. */
+#define STATS_NBUCKETS 12
+
+extern const uint32_t stats_bounds_us[STATS_NBUCKETS - 1];
+
+struct stats_hist {
+    uint64_t count, sum_ns;
+    uint64_t bucket[STATS_NBUCKETS];
+};
+
+struct gamma_stats {
+    struct stats_hist lut_build;     /* cache lookup or build of one LUT */
+    struct stats_hist blob_create;   /* drmModeCreatePropertyBlob() */
+    struct stats_hist commit;        /* atomic commit ioctl */
+    struct stats_hist flip;          /* commit to its flip event */
+    struct stats_hist master;        /* drmSetMaster() + drmDropMaster() around a commit */
+    uint64_t commits;
+    uint64_t fail_ebusy, fail_einval, fail_other;
+    uint64_t fail_master;            /* DRM master held by another client */
+    uint64_t skipped;                /* request already on screen */
+    uint64_t coalesced;              /* target replaced before it was committed */
+    uint64_t last_commit_unix_ns;    /* CLOCK_REALTIME, to line up with video logs */
+};
+
+extern struct gamma_stats g_stats;
+
+void stats_observe(struct stats_hist *h, uint64_t ns);
+
+/* --------------- DRM work --------------- */
+
+/* Everything a preset sets in a CRTC's color pipeline. build_lut() turns
+ * gamma..b, and ch where set, into GAMMA_LUT; degamma and ctm go to
+ * DEGAMMA_LUT and CTM, which the hardware applies before it (0 / the zero
+ * matrix = bypass). Only 8-byte fields, so it can be hashed and compared
+ * bytewise (no padding) by the LUT cache. */
+struct lut_params {
+    double gamma, lift, gain, r, g, b;
+    double degamma;
+    double ctm[9];               /* row-major */
+    double ch[3][3];             /* [gamma|lift|gain][r|g|b], 0 unless set */
+    uint64_t ch_set;             /* bit 3 * field + channel: ch value replaces the shared one */
+};
+
+/* Most CRTCs one request (or the daemon) will drive at once */
+#define MAX_CRTCS 8
+
+/* Per-CRTC property IDs, discovered once by probe_crtc() */
+struct crtc_info {
+    uint32_t crtc_id;
+    uint32_t lut_prop;   /* GAMMA_LUT */
+    uint32_t lut_size;   /* GAMMA_LUT_SIZE */
+    uint32_t lut_blob;   /* GAMMA_LUT value at probe time (0 = linear) */
+    uint32_t degamma_prop, degamma_size;  /* DEGAMMA_LUT(_SIZE), 0 if absent */
+    uint32_t ctm_prop;   /* CTM, 0 if absent */
+    uint32_t degamma_blob, ctm_blob;      /* their values at probe time */
+    bool active;         /* ACTIVE at probe time */
+    bool legacy;         /* no usable GAMMA_LUT: drmModeCrtcSetGamma(), lut_size = gamma_size */
+};
+
+/* Grow-only scratch buffers of the apply paths, so repeated updates (fade
+ * frames, --batch steps, daemon switches) reuse memory instead of going to
+ * the heap. One slot per user; not thread-safe. */
+enum {
+    SCRATCH_RAMP,                /* legacy_get/set_lut(): planar R/G/B */
+    SCRATCH_BLOB,                /* a blob read back to compare */
+    SCRATCH_SHOWN,               /* crtc_shows(): identity / legacy ramp */
+    SCRATCH_DEGAMMA,             /* DEGAMMA_LUT being committed */
+    SCRATCH_FADE,                /* fade_gamma_lut(): from/frame of every CRTC */
+    SCRATCH_BLEND,               /* the second LUT of a --blend */
+    SCRATCH_LUT,                 /* build_luts(): one per distinct LUT size */
+    SCRATCH_SLOTS = SCRATCH_LUT + MAX_CRTCS
+};
+
+/* The CRTC properties read_crtc_props() looks up by name; a board build
+ * has their IDs compiled in (BOARD_PROPS, in this order). */
+enum { CP_GAMMA_LUT, CP_GAMMA_LUT_SIZE, CP_DEGAMMA_LUT, CP_DEGAMMA_LUT_SIZE, CP_CTM, CP_ACTIVE, CP_COUNT };
+
+/* Hardware such as the RK3566 VOP2 only uses the top bits of each 16-bit
+ * entry, so a shallow curve turns into visible steps. quantize_lut() moves
+ * entries onto that grid (expanded back so the top bits are exact), and the rounding
+ * error can be spread across adjacent entries so that gradients average out
+ * instead of banding. */
+#define LUT_BITS_MIN 8
+#define LUT_BITS_MAX 16
+
+enum lut_dither {
+    LUT_DITHER_NONE,             /* round to nearest */
+    LUT_DITHER_ORDERED,          /* 4-entry threshold pattern */
+    LUT_DITHER_DIFFUSE,          /* carry each entry's error into the next */
+};
+
+extern const char *const lut_dither_names[3];
+
+bool color_equal(const struct lut_params *a, const struct lut_params *b);
+uint64_t now_ns(void);
+int create_blob(int fd, const void *data, size_t len, uint32_t *id);
+void *scratch(int slot, size_t len);
+bool blob_read(int fd, uint32_t blob_id, void *buf, size_t len);
+int crtc_prop_ids(int fd, uint32_t crtc_id, uint32_t *id, uint64_t *val);
+int read_crtc_blobs(int fd, struct crtc_info *ci);
+int probe_crtc(int fd, uint32_t crtc_id, struct crtc_info *ci);
+int legacy_get_lut(int fd, const struct crtc_info *ci, struct drm_color_lut *lut);
+void identity_lut(struct drm_color_lut *lut, uint32_t lut_size);
+void read_current_lut(int fd, const struct crtc_info *ci, struct drm_color_lut *lut);
+void build_lut(const struct lut_params *p, struct drm_color_lut *lut, uint32_t lut_size);
+
+/* ---------------- Blending ---------------- */
+
+/* --blend A B t: t is the weight of b (0 = all a, 1 = all b) */
+struct lut_blend {
+    struct lut_params a, b;
+    double t;
+};
+
+enum blend_mode {
+    BLEND_LUT,                   /* mix the two finished LUTs entry by entry */
+    BLEND_PARAMS,                /* mix gamma..b and build the LUT from that */
+};
+
+bool parse_blend_mode(const char *s, enum blend_mode *mode);
+void lerp_lut(const struct drm_color_lut *from, const struct drm_color_lut *to,
+              struct drm_color_lut *out, uint32_t lut_size, double t);
+void blend_params(const struct lut_params *a, const struct lut_params *b, double t,
+                  struct lut_params *out);
+const struct lut_params *blend_color(const struct lut_blend *bl);
+void blend_lut(const struct drm_color_lut *a, const struct drm_color_lut *b,
+               struct drm_color_lut *out, uint32_t lut_size, double t,
+               uint32_t bits, enum lut_dither dither);
+
+/* ------------- Fast LUT kernel ------------- */
+
+/* build_lut_fast() stays within this many 16-bit LSBs of build_lut() */
+#define LUT_FAST_MAX_ERR 1
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define LUT_FAST_IMPL "neon"
+#else
+#define LUT_FAST_IMPL "portable"
+#endif
+
+enum lut_kernel {
+    LUT_KERNEL_REF,              /* build_lut(): double pow() */
+    LUT_KERNEL_FAST,             /* build_lut_fast(): float log2/exp2 polynomials */
+};
+
+void build_lut_fast(const struct lut_params *p, struct drm_color_lut *lut, uint32_t lut_size);
+void build_lut_kernel(enum lut_kernel kernel, const struct lut_params *p,
+                      struct drm_color_lut *lut, uint32_t lut_size);
+bool ctm_set(const struct lut_params *p);
+void build_degamma(const struct lut_params *p, struct drm_color_lut *lut, uint32_t size);
+void build_ctm(const struct lut_params *p, struct drm_color_ctm *m);
+bool crtc_shows(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+                const struct lut_params *color);
+int legacy_commit(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+                  uint32_t blob_id);
+int commit_gamma(int fd, const struct crtc_info *const *ci,
+                 const struct drm_color_lut *const *luts, const uint32_t *blob_ids,
+                 const struct lut_params *const *color,
+                 int n, uint32_t flags, void *user_data);
+int commit_blob(int fd, const struct crtc_info *ci, uint32_t blob_id,
+                uint32_t flags, void *user_data);
+int commit_lut(int fd, const struct crtc_info *ci, const struct drm_color_lut *lut,
+               uint32_t flags, void *user_data);
+int commit_gamma_master(int fd, const struct crtc_info *const *ci,
+                        const struct drm_color_lut *const *luts, const uint32_t *blob_ids,
+                        const struct lut_params *const *color,
+                        int n, uint32_t flags, void *user_data);
+
+/* --------------- Topology --------------- */
+
+#define MAX_OUTPUTS      8
+#define OUTPUT_NAME_MAX  32
+
+/* A connected connector and the CRTC driving it, named like the kernel
+ * names it (HDMI-A-1, DSI-1, ...) */
+struct output {
+    char name[OUTPUT_NAME_MAX];
+    uint32_t conn_id;
+    uint32_t crtc_id;
+};
+
+/* Result of discovery on the first card with a usable GAMMA_LUT (or legacy ramp) */
+struct topology {
+    char card[32];                      /* /dev/dri/cardN */
+    int ncrtc;
+    struct crtc_info crtc[MAX_CRTCS];   /* every CRTC with a GAMMA_LUT or legacy ramp */
+    int nout;
+    struct output out[MAX_OUTPUTS];
+    uint32_t lut_bits;                  /* effective GAMMA_LUT precision of the driver */
+    bool cached;                        /* loaded from the cache, not scanned */
+    bool board;                         /* the compiled-in board profile (see board_topology()) */
+};
+
+int scan_topology(int fd, const char *card, struct topology *t);
+int open_card_path(const char *path);
+void topology_store(const char *path, const struct topology *t);
+int board_topology(struct topology *t);
+int open_topology(struct topology *t, const char *cache, bool board);
+const struct crtc_info *topology_crtc(const struct topology *t, uint32_t crtc_id);
+
+/* --------------- LUT cache --------------- */
+
+/* A LUT prebuilt by gamma --compile, sorted by key in the database. The
+ * key covers LUT_CACHE_VERSION, so a kernel change retires these too. They
+ * are only used with the kernel, depth and dither they were built with. */
+struct preset_db_lut {
+    uint64_t key;                /* lut_key() */
+    uint64_t off;                /* lut_size entries at this file offset */
+    uint64_t sum;                /* lut_sum() of those entries */
+    struct lut_params params;
+    uint32_t lut_size;
+    uint32_t kernel;             /* lut_variant() */
+};
+
+struct lut_file;
+
+/* How LUTs are produced: which kernel, and where they are cached */
+struct lut_opts {
+    const char *cache_dir;       /* NULL = no on-disk cache */
+    enum lut_kernel kernel;
+    uint32_t bits;               /* effective entry precision, 0 = full 16 bits */
+    enum lut_dither dither;      /* rounding onto that precision */
+    const struct lut_file *file; /* --lut-file: every LUT comes from it instead */
+    const struct lut_blend *blend; /* --blend: every LUT is this mix (params only pick the color) */
+};
+
+uint32_t lut_variant(const struct lut_opts *lo);
+void build_lut_opts(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size);
+uint64_t lut_key(const struct lut_params *p, uint32_t lut_size, uint32_t variant);
+uint64_t lut_sum(const struct drm_color_lut *lut, uint32_t lut_size);
+bool lut_cache_read(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size, uint64_t *sum);
+bool lut_cache_load(const struct lut_opts *lo, const struct lut_params *p,
+                    struct drm_color_lut *lut, uint32_t lut_size);
+void lut_cache_store(const struct lut_opts *lo, const struct lut_params *p,
+                     const struct drm_color_lut *lut, uint32_t lut_size);
+const struct preset_db_lut *preset_db_lut_find(const struct lut_opts *lo,
+                                               const struct lut_params *p, uint32_t lut_size,
+                                               const void **data);
+bool preset_db_lut_load(const struct lut_opts *lo, const struct lut_params *p,
+                        struct drm_color_lut *lut, uint32_t lut_size);
+
+/* ----------------- Params ----------------- */
+
+bool preset_to_params(const struct preset_vals *pv, struct lut_params *p);
+bool shm_params(const double *v, struct lut_params *p);
+
+#endif /* GAMMA_CORE_H */
@@ -0,0 +1,140 @@
+// gamma-shm.h — shared-memory control ring of `gamma --daemon --shm <file>`
+//
+// A single producer (for example a video pipeline's frame callback) posts
+// preset switches or curve parameters without a syscall or a wakeup:
+//
+//   struct gamma_shm *s = gamma_shm_open("/run/gamma.shm");
+//   gamma_shm_preset(s, 0, 0, "milos1");
+//   gamma_shm_params(s, 0, 100, 0.9, -0.05, 1.2, 1.0, 1.0, 1.0);
+//
+// The daemon creates the file and, shortly before each vblank, picks up
+// only the latest entry; earlier ones that it never saw are dropped. Every
+// entry is guarded by its own sequence count (odd while written), so the
+// daemon never applies a half-written entry and the producer never blocks.
+// Only one thread or process may produce at a time.
+//
+// Header-only, no libdrm needed; needs GCC/Clang __atomic builtins.
+
+#ifndef GAMMA_SHM_H
+#define GAMMA_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GAMMA_SHM_MAGIC    0x52534d47u   /* "GMSR" */
+#define GAMMA_SHM_VERSION  1
+#define GAMMA_SHM_SLOTS    8             /* power of two */
+#define GAMMA_SHM_NAME_MAX 63
+
+enum gamma_shm_kind {
+    GAMMA_SHM_PRESET = 1,        /* preset: a preset name (or "reset") */
+    GAMMA_SHM_PARAMS = 2,        /* v: gamma lift gain r g b */
+};
+
+struct gamma_shm_entry {
+    uint32_t seq;                /* odd while the producer writes the entry */
+    uint32_t kind;               /* enum gamma_shm_kind */
+    uint32_t crtc_id;            /* 0 = the daemon's default CRTCs */
+    uint32_t fade_ms;            /* 0 = switch at once */
+    double v[6];
+    char preset[GAMMA_SHM_NAME_MAX + 1];
+};
+
+struct gamma_shm {
+    uint32_t magic;              /* GAMMA_SHM_MAGIC once the daemon set it up */
+    uint32_t version;            /* GAMMA_SHM_VERSION */
+    uint32_t slots;              /* GAMMA_SHM_SLOTS */
+    uint32_t entry_size;         /* sizeof(struct gamma_shm_entry) */
+    uint64_t head;               /* entries published; entry n is ring[(n - 1) % slots] */
+    uint64_t consumed;           /* head as of the daemon's last pick-up */
+    struct gamma_shm_entry ring[GAMMA_SHM_SLOTS];
+};
+
+/* Map the daemon's ring. return: NULL with errno set (EPROTO: not a ring
+ * of this version, or the daemon has not set it up yet) */
+static inline struct gamma_shm *gamma_shm_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(struct gamma_shm)) {
+        m = mmap(NULL, sizeof(struct gamma_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        errno = EPROTO;
+    }
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+
+    struct gamma_shm *s = (struct gamma_shm *)m;
+    if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != GAMMA_SHM_MAGIC ||
+        s->version != GAMMA_SHM_VERSION || s->slots != GAMMA_SHM_SLOTS ||
+        s->entry_size != sizeof(struct gamma_shm_entry)) {
+        munmap(m, sizeof(struct gamma_shm));
+        errno = EPROTO;
+        return NULL;
+    }
+    return s;
+}
+
+static inline void gamma_shm_close(struct gamma_shm *s) {
+    if (s) munmap(s, sizeof(*s));
+}
+
+/* Publish e (its seq is ignored) as the next entry. Wait-free. */
+static inline void gamma_shm_publish(struct gamma_shm *s, const struct gamma_shm_entry *e) {
+    uint64_t head = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    struct gamma_shm_entry *slot = &s->ring[head % GAMMA_SHM_SLOTS];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) | 1u;
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + sizeof(slot->seq), (const char *)e + sizeof(e->seq),
+           sizeof(*e) - sizeof(e->seq));
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void gamma_shm_preset(struct gamma_shm *s, uint32_t crtc_id, uint32_t fade_ms,
+                                    const char *name) {
+    struct gamma_shm_entry e;
+    memset(&e, 0, sizeof(e));
+    e.kind = GAMMA_SHM_PRESET;
+    e.crtc_id = crtc_id;
+    e.fade_ms = fade_ms;
+    strncpy(e.preset, name, GAMMA_SHM_NAME_MAX);
+    gamma_shm_publish(s, &e);
+}
+
+static inline void gamma_shm_params(struct gamma_shm *s, uint32_t crtc_id, uint32_t fade_ms,
+                                    double gamma, double lift, double gain,
+                                    double r, double g, double b) {
+    struct gamma_shm_entry e;
+    memset(&e, 0, sizeof(e));
+    e.kind = GAMMA_SHM_PARAMS;
+    e.crtc_id = crtc_id;
+    e.fade_ms = fade_ms;
+    e.v[0] = gamma; e.v[1] = lift; e.v[2] = gain;
+    e.v[3] = r;     e.v[4] = g;    e.v[5] = b;
+    gamma_shm_publish(s, &e);
+}
+
+/* Consumer side (the daemon): copy entry n (1-based, see head) into e.
+ * return: 0, or -1 if the producer is rewriting that slot (try later) */
+static inline int gamma_shm_read(const struct gamma_shm *s, uint64_t n, struct gamma_shm_entry *e) {
+    const struct gamma_shm_entry *slot = &s->ring[(n - 1) % GAMMA_SHM_SLOTS];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1u) return -1;
+    memcpy(e, slot, sizeof(*e));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) return -1;
+    /* A lap of the ring rewrote the slot between reading head and seq */
+    if (__atomic_load_n(&s->head, __ATOMIC_ACQUIRE) - n >= GAMMA_SHM_SLOTS) return -1;
+    return 0;
+}
+
+#endif /* GAMMA_SHM_H */
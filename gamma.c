@@ -1,566 +1,4232 @@
 // gamma.c — DRM GAMMA_LUT setter with presets + --list + reset
 //
 // Build:
-//   gcc -std=c11 -O2 -D_GNU_SOURCE -DDEFAULT_CRTC=68 gamma.c -o gamma $(pkg-config --cflags --libs libdrm) -lm
+//   gcc -std=c11 -O2 -D_GNU_SOURCE -DDEFAULT_CRTC=68 gamma.c gamma-core.c -o gamma $(pkg-config --cflags --libs libdrm) -lm -pthread
+//
+// The core (presets, LUTs, commit path, topology) is gamma-core.c; libgamma
+// links the same object.
 //
 // Usage:
-//   ./gamma [--crtc <id>] [--presets <file>] <gamma_pow> [lift gain r g b]
-//   ./gamma [--crtc <id>] [--presets <file>] <preset-name>
+//   ./gamma [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] <gamma_pow> [lift gain r g b]
+//   ./gamma [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] <preset-name>
 //   ./gamma [--presets <file>] --list
+//   ./gamma --outputs
+//   ./gamma [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--socket <path>] [--state <file>]
+//           [--shm <file>] --daemon
+//   ./gamma --socket <path> [--crtc <id>] [--fade <ms>] [--wait] <gamma_pow ...|preset-name>
+//   ./gamma [--crtc <id>] --daemon --adaptive <dark>,<bright> [--light <file|fifo|->] [--light-range <lo>,<hi>]
+//   ./gamma --socket <path> --light <value> | --auto
+//   ./gamma [--socket <path>] --stats
+//   ./gamma [--presets <file>] --verify
+//   ./gamma [--crtc <id>] [--presets <file>] [--fast] [--cpu-only] --bench <N> [gamma_pow ...|preset-name]
+//   ./gamma --compile <presets.ini> [-o <presets.bin|board.h>] [--lut-sizes 256,1024] [--fast]
+//   ./gamma [--crtc <id>] [--fade <ms>] [--async] [--wait] --lut-file <file|->
+//   ./gamma [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] --batch <file|->
+//   ./gamma [--crtc <id>] [--presets <file>] --save-boot <file> <gamma_pow ...|preset-name>
+//   ./gamma --boot <file>
+//   ./gamma [--crtc <id>] [--presets <file>] [--dump-format summary|csv|raw] --dump
+//   ./gamma [--crtc <id>] [--presets <file>] [--fade <ms>] [--socket <path>] [--blend-mode lut|params]
+//           --blend <A> <B> <t>
+//   ./gamma [--crtc <id>] --board-profile
+//
+// A LUT (with its DEGAMMA_LUT and CTM) that is already on screen, as read back
+// from the CRTC's blobs, is not committed again: "unchanged crtc=<ids>" is
+// printed instead and the exit status is 0. --force commits anyway.
+//
+// --save-boot <file> stores the finished LUT with its card, CRTC and property
+// IDs; --boot <file> replays it early in boot (gamma-boot.service) with a
+// handful of syscalls and prints how long it took.
+//
+// --batch runs one step per line ("<preset|gamma ...> [hold <ms>] [vblank <N>]")
+// in a single process, with one card fd and the cached CRTC properties.
+//
+// --lut-bits <8..16> sets the precision the hardware really uses of each LUT
+// entry (detected per driver: rockchip = 10); entries are rounded onto it with
+// --dither none|ordered|diffuse (default diffuse). "reset" stays bit-exact.
+//
+// --fast builds LUTs with a single-precision kernel (NEON on aarch64) that
+// stays within 1 LSB of the double reference; --verify checks that bound.
+// --bench times each stage of a preset switch (--cpu-only: LUT kernels only).
+//
+// --blend A B t shows a mix of two presets at weight t (0 = A, 1 = B): by
+// default both LUTs come through the caches and are mixed entry by entry with
+// no pow() at all; --blend-mode params mixes gamma..b and builds one curve.
+// DEGAMMA_LUT and CTM come from the nearer preset.
+//
+// --dump reads back the GAMMA_LUT on each target and prints its content hash
+// and the preset it matches; the hash is kept next to every cached or compiled
+// LUT, so matching is a lookup in an index of those hashes. Nothing is built
+// or cached: a preset in neither cache is "unknown". --dump-format csv|raw
+// writes the LUT instead, in a form --lut-file reads back.
+//
+// --crtc may be repeated (or be "all"); every CRTC is then set by one atomic
+// commit, with the LUT built once per GAMMA_LUT_SIZE. --output <name> picks
+// the CRTC driving a connector. The card, CRTCs and outputs are discovered
+// once and cached in /run (see --outputs); a default CRTC that does not exist
+// on this board falls back to the discovered one.
 //
 // Presets search order (unless overridden with --presets <file>):
 //   1) ./presets.ini
 //   2) /etc/gamma-presets.ini
 //
+// gamma --compile presets.ini [-o presets.bin] [--lut-sizes 256,1024] validates
+// the presets once into a binary database that is used in place of the INI
+// (mapped, binary-searched, no parsing) until the INI is newer than it.
+//
+// A board build (make BOARD_CARD=... BOARD_LUT_SIZE=... BOARD_PROPS=..., as
+// printed by --board-profile) has one board's card, CRTC and property IDs
+// compiled in: they are checked with one property read instead of discovery,
+// and a board that does not match is discovered as usual. BOARD_PRESETS=<ini>
+// compiles that file's database (-o gamma-board.h) into the binary, first in
+// the search order.
+//
+// Presets may give each channel its own curve (gamma_r .. gain_b), and may set
+// degamma=<exp> and ctm=<9 coefficients>; DEGAMMA_LUT, CTM and GAMMA_LUT are
+// then committed together in one atomic request.
+//
+// Cards without atomic modesetting, and CRTCs without GAMMA_LUT, fall back to
+// the legacy drmModeCrtcSetGamma() ramp (gamma_size entries), fed by the same
+// LUT builder and caches.
+//
 // Built-in preset: "reset" → gamma=1, lift=0, gain=1, r=g=b=1
+//
+// Daemon mode keeps the DRM card open and the CRTC property IDs cached, and
+// accepts one request per line on a UNIX socket (default /run/gamma.sock):
+//   [--crtc <id>|all ...] [--fade <ms>] [--wait] [--force] <gamma_pow> [lift gain r g b]
+//   [--crtc <id>|all ...] [--fade <ms>] [--wait] [--force] <preset-name>
+//   [--crtc <id>|all ...] [--fade <ms>] [--wait] [--force] [--blend-mode lut|params] --blend <A> <B> <t>
+// Each request is answered with "ok" or "error <exit-code>"; with --wait the
+// answer is delayed until the LUT is on screen. Idle CRTCs that already show
+// the LUT are skipped and reported in an "unchanged crtc=<ids>" line first.
+// "--stats" is answered with counters and latency histograms of the apply
+// pipeline (LUT build, blob create, commit, flip), in Prometheus text format.
+// Preset files are watched with inotify; a changed preset that is on screen is
+// re-applied at once.
+// When the card reports a modeset or hotplug (a "change" uevent), every CRTC
+// the daemon has set is read back, and one whose LUT was reset gets its cached
+// blob committed again. --state <file> keeps a --boot snapshot of those LUTs
+// up to date, so gamma-boot.service restores them after a reboot.
+// --shm <file> adds a lock-free shared-memory ring (gamma-shm.h) for a
+// producer in another process; the newest entry is picked up once per frame,
+// just before vblank.
+// With --adaptive the daemon blends between two presets by a light level read
+// from an IIO sensor file, a FIFO/stdin of values, or "--light <value>"
+// requests; updates are smoothed, rate-limited and need to pass a hysteresis.
+
+#ifndef DEFAULT_SOCKET
+#define DEFAULT_SOCKET "/run/gamma.sock"
+#endif
 
-#ifndef DEFAULT_CRTC
-#define DEFAULT_CRTC 68
+#ifndef ADAPT_INTERVAL_MS
+#define ADAPT_INTERVAL_MS 500    /* shortest time between --adaptive updates */
+#endif
+
+#ifndef WARM_THREADS
+#define WARM_THREADS 0           /* daemon warm-up workers, 0 = one per online CPU */
 #endif
 
 #define _GNU_SOURCE 1
-#include <xf86drm.h>
-#include <xf86drmMode.h>
-#include <drm/drm_mode.h>
+#include "gamma-core.h"
+
+#include <linux/netlink.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
-/* Some systems don’t expose O_CLOEXEC unless _GNU_SOURCE; add fallback */
-#ifndef O_CLOEXEC
-#define O_CLOEXEC 0
-#endif
-
-/* Safe bounds to avoid black/white screens */
-#define GAMMA_MIN 0.10
-#define GAMMA_MAX 5.00
-#define LIFT_MIN  -1.00
-#define LIFT_MAX   1.00
-#define GAIN_MIN   0.00
-#define GAIN_MAX  10.00
-#define MULT_MIN   0.00
-#define MULT_MAX   4.00
+#include "gamma-shm.h"
 
 /* ----------------- Helpers ----------------- */
 
 static void print_usage(const char *argv0) {
     fprintf(stderr,
         "Usage:\n"
-        "  %s [--crtc <id>] [--presets <file>] <gamma_pow> [lift gain r g b]\n"
-        "  %s [--crtc <id>] [--presets <file>] <preset-name>\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] <gamma_pow> [lift gain r g b]\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] <preset-name>\n"
         "  %s [--presets <file>] --list\n"
+        "  %s --outputs\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--socket <path>] [--state <file>]\n"
+        "      [--shm <file>] --daemon\n"
+        "  %s --socket <path> [--crtc <id>] [--fade <ms>] [--wait] <gamma_pow ...|preset-name>\n"
+        "  %s [--crtc <id>] --daemon --adaptive <dark>,<bright> [--light <file|fifo|->] [--light-range <lo>,<hi>]\n"
+        "  %s --socket <path> --light <value> | --auto\n"
+        "  %s [--socket <path>] --stats\n"
+        "  %s [--presets <file>] --verify\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fast] [--cpu-only] --bench <N> [gamma_pow ...|preset-name]\n"
+        "  %s --compile <presets.ini> [-o <presets.bin|board.h>] [--lut-sizes 256,1024] [--fast]\n"
+        "  %s [--crtc <id>] [--fade <ms>] [--async] [--wait] --lut-file <file|->\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fade <ms>] [--async] [--wait] --batch <file|->\n"
+        "  %s [--crtc <id>] [--presets <file>] --save-boot <file> <gamma_pow ...|preset-name>\n"
+        "  %s --boot <file>\n"
+        "  %s [--crtc <id>] [--presets <file>] [--dump-format summary|csv|raw] --dump\n"
+        "  %s [--crtc <id>] [--presets <file>] [--fade <ms>] [--socket <path>] [--blend-mode lut|params]\n"
+        "      --blend <A> <B> <t>\n"
+        "  %s [--crtc <id>] --board-profile\n"
+        "A compiled presets.bin next to presets.ini is used unless the .ini is newer.\n"
+        "A LUT that is already on screen is not recommitted ('unchanged'); --force commits it anyway.\n"
+        "Add --fast to build LUTs with the single-precision kernel (--verify checks it).\n"
+        "--lut-bits <8..16> (default: per driver) and --dither none|ordered|diffuse set LUT rounding.\n"
+        "--blend mixes presets A and B at t (0..1): their LUTs (default) or, with --blend-mode params,\n"
+        "  their curve parameters; DEGAMMA_LUT and CTM come from the nearer one.\n"
+        "--dump reads back the GAMMA_LUT and names the preset it matches (csv/raw: for --lut-file).\n"
+        "--board-profile prints the make variables of a board build for the CRTC (see the Makefile).\n"
+        "--crtc may be repeated, or 'all' (every active CRTC with GAMMA_LUT); all are set in one commit.\n"
+        "--output <name> (e.g. HDMI-A-1, see --outputs) selects the CRTC driving a connector.\n"
         "Default CRTC: %u\n"
+        "Default socket: %s\n"
+        "--adaptive maps --light-range (default 0,1) onto the two presets and updates every %d ms at most.\n"
+        "--state <file> keeps a --boot snapshot of the daemon's LUTs (e.g. for gamma-boot.service).\n"
+        "--shm <file> adds a shared-memory ring (gamma-shm.h), read once per frame before vblank.\n"
+        "LUT cache: %s, topology cache: %s (disable both with --no-cache)\n"
         "Preset search order (unless --presets given):\n"
+        BOARD_DB_USAGE
         "  ./presets.ini\n"
         "  /etc/gamma-presets.ini\n"
         "Ranges:\n"
         "  gamma ∈ [%.2f, %.2f]\n"
         "  lift  ∈ [%.2f, %.2f]\n"
         "  gain  ∈ [%.2f, %.2f]\n"
-        "  r,g,b ∈ [%.2f, %.2f]\n",
-        argv0, argv0, argv0, DEFAULT_CRTC,
+        "  r,g,b ∈ [%.2f, %.2f]\n"
+        "  ctm   ∈ [%.2f, %.2f] (preset key, 9 coefficients), degamma like gamma\n",
+        argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0,
+        argv0, argv0, argv0, argv0, argv0,
+        DEFAULT_CRTC, DEFAULT_SOCKET, ADAPT_INTERVAL_MS, LUT_CACHE_DIR, TOPOLOGY_CACHE,
         GAMMA_MIN, GAMMA_MAX,
         LIFT_MIN, LIFT_MAX,
         GAIN_MIN, GAIN_MAX,
-        MULT_MIN, MULT_MAX
+        MULT_MIN, MULT_MAX,
+        CTM_MIN, CTM_MAX
     );
 }
 
-static bool parse_uint32(const char *s, uint32_t *out) {
-    char *end = NULL;
-    errno = 0;
-    unsigned long v = strtoul(s, &end, 0);
-    if (errno || end == s || (end && *end)) return false;
-    *out = (uint32_t)v;
-    return true;
+/* Heap allocations by this program and by libdrm; steady-state updates
+ * (fade frames, daemon switches, --batch steps) should make none. Only a
+ * build with GAMMA_HEAP_COUNT (make bench) counts them, by interposing
+ * glibc's allocation entry points; the installed binary keeps libc's own.
+ * Ours are weak, and where libc's win (a static link may keep them) counted
+ * stays false. */
+static struct {
+    uint64_t allocs;
+    bool counted;
+} g_heap;
+
+#if defined(GAMMA_HEAP_COUNT) && defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+static void heap_count(void) {
+    __atomic_add_fetch(&g_heap.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_heap.counted, true, __ATOMIC_RELAXED);
 }
 
-static bool parse_double_strict(const char *s, double *out) {
-    char *end = NULL;
-    errno = 0;
-    double v = strtod(s, &end);
-    if (errno || end == s || *end != '\0') return false;
-    if (!isfinite(v)) return false;
-    *out = v;
-    return true;
+__attribute__((weak)) void *malloc(size_t size) {
+    heap_count();
+    return __libc_malloc(size);
 }
 
-static bool parse_double_in_range(const char *label, const char *s,
-                                  double minv, double maxv, double *out) {
-    double v;
-    if (!parse_double_strict(s, &v)) {
-        fprintf(stderr, "Invalid %s: '%s'\n", label, s);
-        return false;
+__attribute__((weak)) void *calloc(size_t n, size_t size) {
+    heap_count();
+    return __libc_calloc(n, size);
+}
+
+__attribute__((weak)) void *realloc(void *ptr, size_t size) {
+    heap_count();
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((weak)) void *memalign(size_t align, size_t size) {
+    heap_count();
+    return __libc_memalign(align, size);
+}
+
+__attribute__((weak)) void *aligned_alloc(size_t align, size_t size) {
+    heap_count();
+    return __libc_memalign(align, size);
+}
+
+__attribute__((weak)) int posix_memalign(void **out, size_t align, size_t size) {
+    if (!align || (align & (align - 1)) || align % sizeof(void *)) return EINVAL;
+    heap_count();
+    void *p = __libc_memalign(align, size);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+#endif
+
+static uint64_t heap_allocs(void) {
+    return __atomic_load_n(&g_heap.allocs, __ATOMIC_RELAXED);
+}
+
+/* dprintf() gives every call a heap-allocated stream buffer; replies and
+ * --stats are formatted on the stack instead, so serving them does not
+ * show up in gamma_heap_allocations_total. Output is cut at 1 KiB. */
+__attribute__((format(printf, 2, 3)))
+static void fd_printf(int fd, const char *fmt, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > (int)sizeof(buf) - 1) n = (int)sizeof(buf) - 1;
+    if (n > 0 && write(fd, buf, (size_t)n) < 0) { /* the client went away */ }
+}
+
+static void stats_write_hist(int fd, const char *name, const char *help, const struct stats_hist *h) {
+    fd_printf(fd, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cum = 0;
+    for (size_t b = 0; b < STATS_NBUCKETS - 1; b++) {
+        cum += h->bucket[b];
+        fd_printf(fd, "%s_bucket{le=\"%g\"} %llu\n", name, stats_bounds_us[b] / 1e6,
+                (unsigned long long)cum);
     }
-    if (v < minv || v > maxv) {
-        fprintf(stderr, "%s out of range: %g (allowed %.2f..%.2f)\n",
-                label, v, minv, maxv);
-        return false;
+    fd_printf(fd, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->count);
+    fd_printf(fd, "%s_sum %.9f\n%s_count %llu\n", name, h->sum_ns / 1e9, name,
+            (unsigned long long)h->count);
+}
+
+static void stats_write_counter(int fd, const char *name, const char *help, uint64_t v) {
+    fd_printf(fd, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+            (unsigned long long)v);
+}
+
+/* Prometheus text exposition format */
+static void stats_write(int fd) {
+    stats_write_hist(fd, "gamma_lut_build_seconds", "Time to produce one LUT (cache or build).",
+                     &g_stats.lut_build);
+    stats_write_hist(fd, "gamma_blob_create_seconds", "Time to create one property blob.",
+                     &g_stats.blob_create);
+    stats_write_hist(fd, "gamma_commit_seconds", "Time spent in the atomic commit call.",
+                     &g_stats.commit);
+    stats_write_hist(fd, "gamma_flip_seconds", "Time from an event commit to its flip event.",
+                     &g_stats.flip);
+    stats_write_hist(fd, "gamma_master_seconds", "Time to take and drop DRM master around a commit.",
+                     &g_stats.master);
+    stats_write_counter(fd, "gamma_commits_total", "Successful atomic commits.", g_stats.commits);
+    fd_printf(fd, "# HELP gamma_commit_failures_total Failed atomic commits.\n"
+                "# TYPE gamma_commit_failures_total counter\n"
+                "gamma_commit_failures_total{error=\"EBUSY\"} %llu\n"
+                "gamma_commit_failures_total{error=\"EINVAL\"} %llu\n"
+                "gamma_commit_failures_total{error=\"other\"} %llu\n"
+                "gamma_commit_failures_total{error=\"not_master\"} %llu\n",
+            (unsigned long long)g_stats.fail_ebusy, (unsigned long long)g_stats.fail_einval,
+            (unsigned long long)g_stats.fail_other, (unsigned long long)g_stats.fail_master);
+    stats_write_counter(fd, "gamma_updates_skipped_total",
+                        "Per-CRTC updates skipped because the LUT was already on screen.",
+                        g_stats.skipped);
+    stats_write_counter(fd, "gamma_updates_coalesced_total",
+                        "Per-CRTC targets replaced by a newer one before being committed.",
+                        g_stats.coalesced);
+    if (g_heap.counted) {
+        stats_write_counter(fd, "gamma_heap_allocations_total",
+                            "Heap allocations by gamma and libdrm (GAMMA_HEAP_COUNT builds).",
+                            heap_allocs());
     }
-    *out = v;
-    return true;
+    fd_printf(fd, "# HELP gamma_last_commit_timestamp_seconds Wall-clock time of the last commit.\n"
+                "# TYPE gamma_last_commit_timestamp_seconds gauge\n"
+                "gamma_last_commit_timestamp_seconds %.6f\n", g_stats.last_commit_unix_ns / 1e9);
 }
 
-static inline uint16_t u16clamp(double x) {
-    if (x < 0.0) return 0;
-    if (x > 65535.0) return 65535;
-    return (uint16_t)(x + 0.5);
+static void print_topology(const struct topology *t) {
+    printf("%s\n", t->card);
+    for (int k = 0; k < t->nout; k++) {
+        const struct crtc_info *ci = topology_crtc(t, t->out[k].crtc_id);
+        printf("  %-12s crtc %u", t->out[k].name, t->out[k].crtc_id);
+        if (ci) printf("  GAMMA_LUT_SIZE %u%s\n", ci->lut_size, ci->legacy ? " (legacy)" : "");
+        else printf("  (no GAMMA_LUT)\n");
+    }
+    for (int k = 0; k < t->ncrtc; k++) {
+        bool shown = false;
+        for (int j = 0; j < t->nout; j++) {
+            if (t->out[j].crtc_id == t->crtc[k].crtc_id) shown = true;
+        }
+        if (!shown) printf("  %-12s crtc %u  GAMMA_LUT_SIZE %u%s%s\n", "-", t->crtc[k].crtc_id,
+                           t->crtc[k].lut_size, t->crtc[k].legacy ? " (legacy)" : "",
+                           t->crtc[k].active ? "" : " (inactive)");
+    }
+}
+
+static void lut_file_fill(const struct lut_file *lf, struct drm_color_lut *lut, uint32_t lut_size);
+
+/* Build with the selected kernel, unless a preset database or the on-disk
+ * cache (both skipped by --no-cache) already has the LUT.
+ * return: 0, -1 if a --blend found no buffer for its second LUT */
+static int cached_build_lut(const struct lut_opts *lo, const struct lut_params *p,
+                            struct drm_color_lut *lut, uint32_t lut_size) {
+    if (lo->blend) {
+        /* Both LUTs through the caches, then mixed; the mix is not cached */
+        struct lut_opts one = *lo;
+        one.blend = NULL;
+        struct drm_color_lut *b = scratch(SCRATCH_BLEND, sizeof(*b) * lut_size);
+        if (!b) { perror("realloc(lut)"); return -1; }
+        cached_build_lut(&one, &lo->blend->a, lut, lut_size);
+        cached_build_lut(&one, &lo->blend->b, b, lut_size);
+        blend_lut(lut, b, lut, lut_size, lo->blend->t, lo->bits, lo->dither);
+        return 0;
+    }
+    uint64_t t0 = now_ns();
+    if (lo->file) {
+        lut_file_fill(lo->file, lut, lut_size);
+    } else if (!lo->cache_dir || !(preset_db_lut_load(lo, p, lut, lut_size) ||
+                                   lut_cache_load(lo, p, lut, lut_size))) {
+        build_lut_opts(lo, p, lut, lut_size);
+        if (lo->cache_dir) lut_cache_store(lo, p, lut, lut_size);
+    }
+    stats_observe(&g_stats.lut_build, now_ns() - t0);
+    return 0;
 }
 
-/* -------------- INI handling -------------- */
+/* Daemon warm-up: the preset x LUT size matrix is built by a pool of
+ * worker threads while the daemon already serves requests. The job array
+ * only changes while no worker runs. Workers claim queued jobs and fill in
+ * their LUTs from the disk cache or the kernel, and touch nothing else:
+ * not the preset files, the scratch buffers or the stats. The main thread
+ * picks up finished LUTs (warm.efd counts them), and takes over any job
+ * a request needs before a worker got to it. */
+#define WARM_THREADS_MAX 8
+
+enum { WARM_QUEUED, WARM_BUILDING, WARM_DONE, WARM_TAKEN };
 
-struct preset_vals {
-    bool have_gamma, have_lift, have_gain, have_r, have_g, have_b;
-    double gamma, lift, gain, r, g, b;
-    bool have_crtc;
-    uint32_t crtc;
+struct warm_job {
+    uint64_t key;                /* lut_key() */
+    struct lut_params params;
+    uint32_t lut_size;
+    int state;                   /* WARM_*, atomic once workers run */
+    struct drm_color_lut *lut;   /* owned until the main thread takes it */
 };
 
-static void s_trim(char *s) {
-    /* left trim */
-    char *p = s;
-    while (*p && (*p==' '||*p=='\t'||*p=='\r'||*p=='\n')) p++;
-    if (p != s) memmove(s, p, strlen(p)+1);
-    /* right trim */
-    size_t n = strlen(s);
-    while (n>0 && (s[n-1]==' '||s[n-1]=='\t'||s[n-1]=='\r'||s[n-1]=='\n')) s[--n]='\0';
-    /* strip UTF-8 BOM if present */
-    if ((unsigned char)s[0]==0xEF && (unsigned char)s[1]==0xBB && (unsigned char)s[2]==0xBF) {
-        memmove(s, s+3, strlen(s+3)+1);
+struct lut_warm {
+    const struct lut_opts *opts; /* the daemon's, fixed after startup */
+    int efd;                     /* eventfd, -1 = build in the main thread */
+    int n, cap;
+    struct warm_job *job;
+    int next;                    /* next job for a worker to look at, atomic */
+    int nthreads;                /* workers started, 0 = none running */
+    pthread_t thread[WARM_THREADS_MAX];
+    uint64_t t0;                 /* start of the warm-up, 0 = none pending */
+};
+
+static void warm_build(const struct lut_opts *lo, struct warm_job *j) {
+    if (lo->cache_dir && lut_cache_load(lo, &j->params, j->lut, j->lut_size)) return;
+    build_lut_opts(lo, &j->params, j->lut, j->lut_size);
+    if (lo->cache_dir) lut_cache_store(lo, &j->params, j->lut, j->lut_size);
+}
+
+static void *warm_worker(void *arg) {
+    struct lut_warm *w = arg;
+    uint64_t one = 1;
+    for (;;) {
+        int i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+        if (i >= w->n) break;
+        struct warm_job *j = &w->job[i];
+        int q = WARM_QUEUED;
+        if (!__atomic_compare_exchange_n(&j->state, &q, WARM_BUILDING, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        warm_build(w->opts, j);
+        __atomic_store_n(&j->state, WARM_DONE, __ATOMIC_RELEASE);
+        if (w->efd >= 0 && write(w->efd, &one, sizeof(one)) < 0) { /* the count is only a wakeup */ }
     }
+    /* Also wake the main thread when its own takeovers left nothing to report */
+    if (w->efd >= 0 && write(w->efd, &one, sizeof(one)) < 0) { }
+    return NULL;
 }
 
-static bool file_exists(const char *path) {
-    return access(path, R_OK) == 0;
+/* Stop the workers after their current LUT. Jobs keep their state. */
+static void warm_stop(struct lut_warm *w) {
+    if (!w->nthreads) return;
+    __atomic_store_n(&w->next, w->n, __ATOMIC_RELAXED);
+    for (int k = 0; k < w->nthreads; k++) pthread_join(w->thread[k], NULL);
+    w->nthreads = 0;
 }
 
-static int list_presets_from_file(const char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) return 0;
-    char line[512];
-    int count = 0;
-    while (fgets(line, sizeof(line), f)) {
-        char *sc = strpbrk(line, "#;");
-        if (sc) *sc = '\0';
-        s_trim(line);
-        if (!*line) continue;
-        if (line[0]=='[') {
-            char *rb = strchr(line, ']');
-            if (rb) {
-                *rb = '\0';
-                char name[256];
-                /* safe copy of section name */
-                size_t len = strnlen(line+1, sizeof(name)-1);
-                memcpy(name, line+1, len);
-                name[len] = '\0';
-                s_trim(name);
-                if (name[0] && strcmp(name, "config") != 0) {
-                    if (count == 0) printf("Available presets in %s:\n", path);
-                    printf("  %s\n", name);
-                    count++;
-                }
-            }
+/* Drop every job, built or not (their LUTs are in the disk cache anyway). */
+static void warm_reset(struct lut_warm *w) {
+    warm_stop(w);
+    for (int i = 0; i < w->n; i++) free(w->job[i].lut);
+    w->n = 0;
+    w->t0 = 0;
+}
+
+/* Queue p at lut_size (workers must be stopped).
+ * return: 1 if queued, 0 if it is already, -1 if there is no memory for it */
+static int warm_add(struct lut_warm *w, const struct lut_params *p, uint32_t lut_size) {
+    uint64_t key = lut_key(p, lut_size, lut_variant(w->opts));
+    for (int i = 0; i < w->n; i++) {
+        if (w->job[i].key == key && w->job[i].lut_size == lut_size &&
+            !memcmp(&w->job[i].params, p, sizeof(*p))) {
+            return 0;
         }
     }
-    fclose(f);
-    return count;
+    if (w->n == w->cap) {
+        int cap = w->cap ? 2 * w->cap : 64;
+        struct warm_job *nj = realloc(w->job, (size_t)cap * sizeof(*nj));
+        if (!nj) return -1;
+        w->job = nj;
+        w->cap = cap;
+    }
+    struct drm_color_lut *lut = malloc(sizeof(*lut) * lut_size);
+    if (!lut) return -1;
+    w->job[w->n++] = (struct warm_job){
+        .key = key, .params = *p, .lut_size = lut_size, .state = WARM_QUEUED, .lut = lut,
+    };
+    if (!w->t0) w->t0 = now_ns();
+    return 1;
 }
 
-/* return: 1=loaded, 0=not found, -1=parse error */
-static int load_preset_from_file(const char *path, const char *want, struct preset_vals *pv) {
-    FILE *f = fopen(path, "r");
-    if (!f) return 0;
+/* Start workers for the queued jobs, one per online CPU (WARM_THREADS) */
+static void warm_start(struct lut_warm *w) {
+    if (w->nthreads) return;
+    int queued = 0;
+    for (int i = 0; i < w->n; i++) queued += w->job[i].state == WARM_QUEUED;
+    if (!queued) return;
 
-    char line[512];
-    char current[256] = {0};
-    bool wanted = false;
-    int status = 0; /* 0=notfound, 1=loaded, -1=error */
+    long cpus = WARM_THREADS ? WARM_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cpus < 1 ? 1 : cpus > WARM_THREADS_MAX ? WARM_THREADS_MAX : (int)cpus;
+    if (want > queued) want = queued;
+    w->next = 0;
+    for (int k = 0; k < want && w->efd >= 0; k++) {
+        if (pthread_create(&w->thread[k], NULL, warm_worker, w)) break;
+        w->nthreads++;
+    }
+    /* No eventfd or no threads: the old way, here and now */
+    if (!w->nthreads) warm_worker(w);
+}
 
-    while (fgets(line, sizeof(line), f)) {
-        char *sc = strpbrk(line, "#;");
-        if (sc) *sc = '\0';
-        s_trim(line);
-        if (!*line) continue;
-
-        if (line[0]=='[') {
-            char *rb = strchr(line, ']');
-            if (rb) {
-                *rb = '\0';
-                /* safe copy of section name */
-                size_t len = strnlen(line+1, sizeof(current)-1);
-                memcpy(current, line+1, len);
-                current[len] = '\0';
-                s_trim(current);
-                wanted = (strcmp(current, want) == 0);
-            }
-            continue;
+/* A request needs p before the warm-up is through. return: -1 if p is not
+ * a warm-up job, 0 if it is and the caller must build it (the job is taken
+ * from the workers), 1 if lut was filled from the finished job */
+static int warm_take(struct lut_warm *w, uint64_t key, const struct lut_params *p,
+                     struct drm_color_lut *lut, uint32_t lut_size) {
+    for (int i = 0; i < w->n; i++) {
+        struct warm_job *j = &w->job[i];
+        if (j->key != key || j->lut_size != lut_size || memcmp(&j->params, p, sizeof(*p))) continue;
+        int q = WARM_QUEUED;
+        if (__atomic_compare_exchange_n(&j->state, &q, WARM_TAKEN, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            free(j->lut);
+            j->lut = NULL;
+            return 0;
         }
-
-        if (!wanted) continue;
-
-        char *eq = strchr(line, '=');
-        if (!eq) continue;
-        *eq = '\0';
-        char *key = line;
-        char *val = eq + 1;
-        s_trim(key); s_trim(val);
-
-        double dtmp; uint32_t utmp;
-        if (strcmp(key, "gamma")==0) {
-            if (parse_double_in_range("gamma", val, GAMMA_MIN, GAMMA_MAX, &dtmp)) { pv->gamma=dtmp; pv->have_gamma=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "lift")==0) {
-            if (parse_double_in_range("lift", val, LIFT_MIN, LIFT_MAX, &dtmp)) { pv->lift=dtmp; pv->have_lift=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "gain")==0) {
-            if (parse_double_in_range("gain", val, GAIN_MIN, GAIN_MAX, &dtmp)) { pv->gain=dtmp; pv->have_gain=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "r")==0) {
-            if (parse_double_in_range("r", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->r=dtmp; pv->have_r=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "g")==0) {
-            if (parse_double_in_range("g", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->g=dtmp; pv->have_g=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "b")==0) {
-            if (parse_double_in_range("b", val, MULT_MIN, MULT_MAX, &dtmp)) { pv->b=dtmp; pv->have_b=true; status=1; }
-            else { status=-1; break; }
-        } else if (strcmp(key, "crtc")==0) {
-            if (parse_uint32(val, &utmp)) { pv->crtc=utmp; pv->have_crtc=true; status=1; }
-            else { fprintf(stderr,"Invalid crtc in preset: '%s'\n", val); status=-1; break; }
-        } else {
-            /* ignore unknown keys */
+        /* Being built: a worker needs no longer than the caller would */
+        while (q == WARM_BUILDING) {
+            sched_yield();
+            q = __atomic_load_n(&j->state, __ATOMIC_ACQUIRE);
         }
+        if (q != WARM_DONE) return 0;
+        memcpy(lut, j->lut, sizeof(*lut) * lut_size);
+        __atomic_store_n(&j->state, WARM_TAKEN, __ATOMIC_RELAXED);
+        free(j->lut);
+        j->lut = NULL;
+        return 1;
     }
+    return -1;
+}
 
-    fclose(f);
-    return status;
+/* In-memory cache for the daemon, in front of the on-disk one. Each entry can
+ * own a property blob that stays alive, so re-applying it is a single atomic
+ * property set. Entries for presets are pinned; others (ad-hoc numeric
+ * requests, fade targets) are evicted LRU beyond LUT_MEM_SLOTS. */
+#define LUT_MEM_SLOTS 64
+
+struct lut_mem_entry {
+    uint64_t key;                /* lut_key(), to skip most memcmp()s */
+    struct lut_params params;
+    uint32_t lut_size;
+    uint32_t blob_id;            /* 0 = not created yet */
+    uint64_t used;               /* LRU stamp */
+    bool pinned;
+    struct drm_color_lut *lut;
+};
+
+struct lut_mem_cache {
+    struct lut_opts opts;
+    int fd;                      /* DRM fd owning the blobs */
+    struct lut_warm *warm;       /* LUTs being built in the background, NULL = none */
+    uint64_t tick;
+    int n, cap;
+    struct lut_mem_entry *e;
+};
+
+static void lut_mem_drop(struct lut_mem_cache *mc, int i) {
+    if (mc->e[i].blob_id) drmModeDestroyPropertyBlob(mc->fd, mc->e[i].blob_id);
+    free(mc->e[i].lut);
+    mc->e[i] = mc->e[--mc->n];
 }
 
-/* return: 1=loaded, 0=not found, -1=parse error */
-static int load_config_crtc_from_file(const char *path, uint32_t *out_crtc) {
-    FILE *f = fopen(path, "r");
-    if (!f) return 0;
+/* The least recently used unpinned entry, -1 if none; *unpinned gets their count */
+static int lut_mem_oldest(const struct lut_mem_cache *mc, int *unpinned) {
+    int oldest = -1;
+    *unpinned = 0;
+    for (int i = 0; i < mc->n; i++) {
+        if (mc->e[i].pinned) continue;
+        (*unpinned)++;
+        if (oldest < 0 || mc->e[i].used < mc->e[oldest].used) oldest = i;
+    }
+    return oldest;
+}
 
-    char line[512];
-    bool in_config = false;
-    int status = 0;
+static void lut_mem_evict(struct lut_mem_cache *mc) {
+    for (;;) {
+        int unpinned, oldest = lut_mem_oldest(mc, &unpinned);
+        if (unpinned <= LUT_MEM_SLOTS) return;
+        lut_mem_drop(mc, oldest);
+    }
+}
 
-    while (fgets(line, sizeof(line), f)) {
-        char *sc = strpbrk(line, "#;");
-        if (sc) *sc = '\0';
-        s_trim(line);
-        if (!*line) continue;
-
-        if (line[0]=='[') {
-            char *rb = strchr(line, ']');
-            if (rb) {
-                *rb = '\0';
-                char name[256];
-                size_t len = strnlen(line+1, sizeof(name)-1);
-                memcpy(name, line+1, len);
-                name[len] = '\0';
-                s_trim(name);
-                in_config = (strcmp(name, "config") == 0);
-            }
-            continue;
-        }
+/* A missing LUT: from the warm-up if it has (or is about to have) it, else
+ * via the disk cache. return: whether p is a warm-up job, i.e. a preset */
+static bool lut_mem_fill(struct lut_mem_cache *mc, uint64_t key, const struct lut_params *p,
+                         struct drm_color_lut *lut, uint32_t lut_size) {
+    int st = mc->warm ? warm_take(mc->warm, key, p, lut, lut_size) : -1;
+    if (st <= 0) cached_build_lut(&mc->opts, p, lut, lut_size);   /* the daemon has no --blend */
+    return st >= 0;
+}
 
-        if (!in_config) continue;
+/* The entry for p, NULL if there is none (the LRU is not touched) */
+static struct lut_mem_entry *lut_mem_find(struct lut_mem_cache *mc, const struct lut_params *p,
+                                          uint32_t lut_size) {
+    uint64_t key = lut_key(p, lut_size, lut_variant(&mc->opts));
+    for (int i = 0; i < mc->n; i++) {
+        struct lut_mem_entry *e = &mc->e[i];
+        if (e->key == key && e->lut_size == lut_size && !memcmp(&e->params, p, sizeof(*p))) return e;
+    }
+    return NULL;
+}
 
-        char *eq = strchr(line, '=');
-        if (!eq) continue;
-        *eq = '\0';
-        char *key = line;
-        char *val = eq + 1;
-        s_trim(key); s_trim(val);
+/* Find or create the entry for p; computed via the disk cache on a miss.
+ * A preset's LUT taken from the warm-up is pinned like a preloaded one.
+ * return: NULL only on allocation failure */
+static struct lut_mem_entry *lut_mem_get(struct lut_mem_cache *mc, const struct lut_params *p,
+                                         uint32_t lut_size) {
+    struct lut_mem_entry *hit = lut_mem_find(mc, p, lut_size);
+    if (hit) {
+        hit->used = ++mc->tick;
+        return hit;
+    }
+    uint64_t key = lut_key(p, lut_size, lut_variant(&mc->opts));
 
-        if (strcmp(key, "crtc") == 0) {
-            uint32_t utmp;
-            if (parse_uint32(val, &utmp)) {
-                *out_crtc = utmp;
-                status = 1;
-            } else {
-                fprintf(stderr, "Invalid crtc in config: '%s'\n", val);
-                status = -1;
-            }
-            break;
-        }
+    /* A full cache recycles its LRU entry in place when the size matches,
+     * so a stream of new curves (adaptive blends, numeric requests) does
+     * not go to the heap for every one */
+    int unpinned, oldest = lut_mem_oldest(mc, &unpinned);
+    if (unpinned >= LUT_MEM_SLOTS && mc->e[oldest].lut_size == lut_size) {
+        struct lut_mem_entry *e = &mc->e[oldest];
+        if (e->blob_id) drmModeDestroyPropertyBlob(mc->fd, e->blob_id);
+        bool pin = lut_mem_fill(mc, key, p, e->lut, lut_size);
+        *e = (struct lut_mem_entry){
+            .key = key, .params = *p, .lut_size = lut_size,
+            .used = ++mc->tick, .pinned = pin, .lut = e->lut,
+        };
+        return e;
     }
 
-    fclose(f);
-    return status;
+    if (mc->n == mc->cap) {
+        int cap = mc->cap ? 2 * mc->cap : LUT_MEM_SLOTS;
+        struct lut_mem_entry *ne = realloc(mc->e, (size_t)cap * sizeof(*ne));
+        if (!ne) { perror("realloc(lut cache)"); return NULL; }
+        mc->e = ne;
+        mc->cap = cap;
+    }
+    struct drm_color_lut *lut = malloc(sizeof(*lut) * lut_size);
+    if (!lut) { perror("malloc(lut)"); return NULL; }
+    bool pin = lut_mem_fill(mc, key, p, lut, lut_size);
+
+    struct lut_mem_entry *e = &mc->e[mc->n++];
+    *e = (struct lut_mem_entry){
+        .key = key, .params = *p, .lut_size = lut_size,
+        .used = ++mc->tick, .pinned = pin, .lut = lut,
+    };
+    lut_mem_evict(mc);
+    /* eviction may have moved entries; look ours up again */
+    for (int i = 0; i < mc->n; i++) {
+        if (mc->e[i].lut == lut) return &mc->e[i];
+    }
+    return NULL;
 }
 
-static int load_config_crtc(const char *preset_path, uint32_t *out_crtc) {
-    if (preset_path) {
-        return load_config_crtc_from_file(preset_path, out_crtc);
+/* The entry's blob, created on first use. return: 0 on failure */
+static uint32_t lut_mem_blob(struct lut_mem_cache *mc, struct lut_mem_entry *e) {
+    if (!e->blob_id &&
+        create_blob(mc->fd, e->lut, sizeof(*e->lut) * e->lut_size, &e->blob_id)) {
+        perror("drmModeCreatePropertyBlob");
+        e->blob_id = 0;
     }
+    return e->blob_id;
+}
 
-    int st = load_config_crtc_from_file("./presets.ini", out_crtc);
-    if (st != 0) return st;
-    return load_config_crtc_from_file("/etc/gamma-presets.ini", out_crtc);
+static void lut_mem_free(struct lut_mem_cache *mc) {
+    while (mc->n) lut_mem_drop(mc, mc->n - 1);
+    free(mc->e);
 }
 
-static int load_preset(const char *name, const char *preset_path, struct preset_vals *pv) {
-    memset(pv, 0, sizeof(*pv));
+/* --------------- LUT files --------------- */
 
-    if (strcmp(name, "reset")==0) {
-        pv->have_gamma = pv->have_lift = pv->have_gain = pv->have_r = pv->have_g = pv->have_b = true;
-        pv->gamma = 1.0; pv->lift = 0.0; pv->gain = 1.0; pv->r = pv->g = pv->b = 1.0;
-        return 1;
+#define LUT_FILE_MAX 65536       /* entries */
+
+/* --lut-file: raw struct drm_color_lut entries, or text with one entry per
+ * line ("r,g,b" or a single value for all three; '#' starts a comment). */
+struct lut_file {
+    const struct drm_color_lut *lut;
+    uint32_t size;
+    void *map;                   /* binary file mapped in place, else NULL */
+    size_t map_len;
+    void *buf;                   /* stdin contents / parsed entries */
+};
+
+/* Integers are 0..65535; a value with '.' or an exponent is a fraction 0..1 */
+static bool parse_lut_value(const char *s, uint16_t *out) {
+    double v;
+    if (!parse_double_strict(s, &v)) return false;
+    if (strpbrk(s, ".eE")) {
+        if (v < 0.0 || v > 1.0) return false;
+        *out = u16clamp(v * 65535.0);
+    } else {
+        if (v < 0.0 || v > 65535.0) return false;
+        *out = (uint16_t)v;
     }
+    return true;
+}
 
-    if (preset_path) {
-        return load_preset_from_file(preset_path, name, pv);
+static int lut_file_parse(struct lut_file *lf, const char *path, const char *text, size_t len) {
+    struct drm_color_lut *lut = NULL;
+    uint32_t n = 0, cap = 0, line = 0;
+    const char *p = text, *end = text + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *le = nl ? nl : end;
+        char buf[128];
+        size_t l = (size_t)(le - p);
+        line++;
+        if (l >= sizeof(buf)) goto bad;
+        memcpy(buf, p, l);
+        buf[l] = '\0';
+        p = nl ? nl + 1 : end;
+        char *hash = strchr(buf, '#');
+        if (hash) *hash = '\0';
+
+        uint16_t v[3];
+        int nv = 0;
+        for (char *save = NULL, *tok = strtok_r(buf, " \t\r,;", &save); tok;
+             tok = strtok_r(NULL, " \t\r,;", &save)) {
+            if (nv == 3 || !parse_lut_value(tok, &v[nv])) goto bad;
+            nv++;
+        }
+        if (!nv) continue;
+        if (nv == 2) goto bad;
+        if (nv == 1) v[1] = v[2] = v[0];
+        if (n == LUT_FILE_MAX) {
+            fprintf(stderr, "%s: more than %d entries\n", path, LUT_FILE_MAX);
+            free(lut);
+            return -1;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            struct drm_color_lut *nl2 = realloc(lut, cap * sizeof(*lut));
+            if (!nl2) { perror("realloc(lut)"); free(lut); return -1; }
+            lut = nl2;
+        }
+        lut[n++] = (struct drm_color_lut){ .red = v[0], .green = v[1], .blue = v[2] };
     }
+    lf->lut = lut;
+    lf->size = n;
+    lf->buf = lut;
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%u: expected 1 or 3 values (0..65535, or 0.0..1.0)\n", path, line);
+    free(lut);
+    return -1;
+}
 
-    int st = load_preset_from_file("./presets.ini", name, pv);
-    if (st != 0) return st;
-    st = load_preset_from_file("/etc/gamma-presets.ini", name, pv);
-    return st; /* 1=ok, 0=not found, -1=error */
+static void lut_file_close(struct lut_file *lf) {
+    if (lf->map) munmap(lf->map, lf->map_len);
+    free(lf->buf);
+    memset(lf, 0, sizeof(*lf));
 }
 
-static void list_all_presets(const char *preset_path) {
-    int total = 0;
-    if (preset_path) {
-        if (file_exists(preset_path)) {
-            total += list_presets_from_file(preset_path);
+/* Regular files (and a regular file on stdin) are mapped; binary entries
+ * are then used straight from the mapping. A file containing NUL bytes is
+ * binary, anything else is parsed as text. return: 0, -1 after a message */
+static int lut_file_open(struct lut_file *lf, const char *path) {
+    memset(lf, 0, sizeof(*lf));
+    bool is_stdin = !strcmp(path, "-");
+    int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { perror(path); return -1; }
+
+    const char *data = NULL;
+    size_t len = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            lf->map = m;
+            lf->map_len = len = (size_t)st.st_size;
+            data = m;
         }
-    } else {
-        if (file_exists("./presets.ini")) total += list_presets_from_file("./presets.ini");
-        if (file_exists("/etc/gamma-presets.ini")) total += list_presets_from_file("/etc/gamma-presets.ini");
     }
-    if (total == 0) {
-        if (preset_path) {
-            printf("No presets found in %s.\n", preset_path);
+    if (!data) {
+        /* A pipe: read it all (bounded by the largest text a LUT can need) */
+        size_t cap = 0, max = (size_t)LUT_FILE_MAX * 64;
+        char *buf = NULL;
+        for (;;) {
+            if (len == cap) {
+                cap = cap ? cap * 2 : 65536;
+                char *nb = cap <= max ? realloc(buf, cap) : NULL;
+                if (!nb) { fprintf(stderr, "%s: too large\n", path); free(buf); buf = NULL; break; }
+                buf = nb;
+            }
+            ssize_t r = read(fd, buf + len, cap - len);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) { perror(path); free(buf); buf = NULL; break; }
+            if (r == 0) break;
+            len += (size_t)r;
+        }
+        lf->buf = buf;
+        data = buf;
+        if (!buf) len = 0;
+    }
+    if (!is_stdin) close(fd);
+    if (!data) { lut_file_close(lf); return -1; }
+
+    int ret = 0;
+    if (memchr(data, '\0', len)) {
+        if (len % sizeof(struct drm_color_lut)) {
+            fprintf(stderr, "%s: binary size %zu is not a multiple of %zu\n", path, len,
+                    sizeof(struct drm_color_lut));
+            ret = -1;
         } else {
-            printf("No presets.ini found.\n");
+            lf->lut = (const void *)data;
+            lf->size = (uint32_t)(len / sizeof(struct drm_color_lut));
+        }
+    } else {
+        void *text = lf->buf;
+        lf->buf = NULL;
+        ret = lut_file_parse(lf, path, data, len);
+        free(text);
+        if (lf->map) {                  /* text is parsed, the mapping is no longer needed */
+            munmap(lf->map, lf->map_len);
+            lf->map = NULL;
         }
     }
-    printf("  reset\n"); /* built-in */
+    if (!ret && (lf->size < 2 || lf->size > LUT_FILE_MAX)) {
+        fprintf(stderr, "%s: %u entries (need 2..%d)\n", path, lf->size, LUT_FILE_MAX);
+        ret = -1;
+    }
+    if (ret) lut_file_close(lf);
+    return ret;
+}
+
+/* The file's LUT at lut_size entries: a copy when the sizes match, else
+ * linearly resampled. */
+static void lut_file_fill(const struct lut_file *lf, struct drm_color_lut *lut, uint32_t lut_size) {
+    const struct drm_color_lut *in = lf->lut;
+    if (lf->size == lut_size) {
+        memcpy(lut, in, sizeof(*lut) * lut_size);
+        return;
+    }
+    for (uint32_t i = 0; i < lut_size; i++) {
+        double pos = (double)i * (lf->size - 1) / (double)(lut_size - 1);
+        uint32_t j = (uint32_t)pos;
+        if (j > lf->size - 2) j = lf->size - 2;
+        double t = pos - j;
+        lut[i].red   = u16clamp(in[j].red   + (in[j + 1].red   - in[j].red)   * t);
+        lut[i].green = u16clamp(in[j].green + (in[j + 1].green - in[j].green) * t);
+        lut[i].blue  = u16clamp(in[j].blue  + (in[j + 1].blue  - in[j].blue)  * t);
+        lut[i].reserved = 0;
+    }
 }
 
-/* --------------- DRM work --------------- */
+/* ---------------- Fades ---------------- */
 
-static int set_gamma_lut(int fd, uint32_t crtc_id,
-                  double gamma_pow,
-                  double lift,
-                  double gain,
-                  double r_mult,
-                  double g_mult,
-                  double b_mult)
-{
-    drmModeObjectProperties *props =
-        drmModeObjectGetProperties(fd, crtc_id, DRM_MODE_OBJECT_CRTC);
-    if (!props) {
-        perror("drmModeObjectGetProperties");
-        return -1;
+#define FADE_MAX_MS 60000
+#define FADE_FRAME_NS 16666667ull  /* refresh period until one is measured */
+
+/* A frame is committed now and shows at the next vblank, so fades compute
+ * each frame for about one refresh period ahead (t0 moved back by it). */
+static double fade_progress(uint64_t t0, uint32_t fade_ms) {
+    if (!fade_ms) return 1.0;
+    double t = (double)(now_ns() - t0) / ((double)fade_ms * 1e6);
+    return t > 1.0 ? 1.0 : t;
+}
+
+static void on_flip_event(int fd, unsigned int seq, unsigned int sec, unsigned int usec, void *data) {
+    (*(int *)data)--;
+}
+
+/* Block until *left flip events (one per CRTC of the last commit) arrived. */
+static int wait_flips(int fd, int *left) {
+    drmEventContext ev = { .version = 2, .page_flip_handler = on_flip_event };
+    while (*left > 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int n = poll(&pfd, 1, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        if (n == 0) { fprintf(stderr, "Timed out waiting for vblank event\n"); return -1; }
+        if (drmHandleEvent(fd, &ev)) { perror("drmHandleEvent"); return -1; }
     }
+    return 0;
+}
 
-    uint32_t lut_prop = 0;
-    uint64_t lut_size = 256;
-    for (uint32_t i = 0; i < props->count_props; i++) {
-        drmModePropertyRes *p = drmModeGetProperty(fd, props->props[i]);
-        if (!p) continue;
-        if (!strcmp(p->name, "GAMMA_LUT")) {
-            lut_prop = p->prop_id;
-        } else if (!strcmp(p->name, "GAMMA_LUT_SIZE")) {
-            lut_size = props->prop_values[i];
+/* The drmWaitVBlank() type bits that address crtc_id: the ioctl takes the
+ * CRTC's index in the card's resources, looked up once per CRTC.
+ * return: 0, -1 if the CRTC is not on the card */
+static int crtc_vblank_type(int fd, uint32_t crtc_id, uint32_t *type) {
+    static uint32_t cached_id;
+    static int cached_pipe = -1;
+    if (crtc_id != cached_id) {
+        drmModeRes *res = drmModeGetResources(fd);
+        if (!res) return -1;
+        cached_pipe = -1;
+        for (int k = 0; k < res->count_crtcs; k++) {
+            if (res->crtcs[k] == crtc_id) cached_pipe = k;
         }
-        drmModeFreeProperty(p);
+        drmModeFreeResources(res);
+        cached_id = crtc_id;
     }
-    drmModeFreeObjectProperties(props);
+    if (cached_pipe < 0) return -1;
+    if (cached_pipe == 1) *type = DRM_VBLANK_SECONDARY;
+    else *type = ((uint32_t)cached_pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    return 0;
+}
 
-    if (!lut_prop || lut_size == 0) {
-        fprintf(stderr, "CRTC %u has no GAMMA_LUT/GAMMA_LUT_SIZE\n", crtc_id);
+/* Block for count vblanks of crtc_id. */
+static int wait_vblanks(int fd, uint32_t crtc_id, uint32_t count) {
+    uint32_t type;
+    if (crtc_vblank_type(fd, crtc_id, &type)) {
+        fprintf(stderr, "CRTC %u not found for vblank wait\n", crtc_id);
         return -1;
     }
 
-    struct drm_color_lut *lut = calloc(lut_size, sizeof(*lut));
-    if (!lut) { perror("calloc(lut)"); return -1; }
+    drmVBlank vbl = { .request = { .type = DRM_VBLANK_RELATIVE | type, .sequence = count } };
+    if (drmWaitVBlank(fd, &vbl)) {
+        perror("drmWaitVBlank");
+        return -1;
+    }
+    return 0;
+}
 
-    for (uint32_t i = 0; i < lut_size; i++) {
-        double x = (double)i / (double)(lut_size - 1);
-        double y = pow(x, gamma_pow);
-        y += lift;
-        y *= gain;
-        if (y < 0.0) y = 0.0;
-        if (y > 1.0) y = 1.0;
+/* The flip events a commit to these CRTCs will send: none from legacy ones */
+static int flip_events(const struct crtc_info *const *ci, int n) {
+    int events = 0;
+    for (int k = 0; k < n; k++) events += !ci[k]->legacy;
+    return events;
+}
 
-        double r = fmax(0.0, fmin(1.0, y * r_mult));
-        double g = fmax(0.0, fmin(1.0, y * g_mult));
-        double b = fmax(0.0, fmin(1.0, y * b_mult));
+/* p's LUT for each distinct lut_size of one apply. It is built once, and
+ * the dirty check, the commit and the fade all use that copy. */
+struct apply_luts {
+    int n;
+    uint32_t size[MAX_CRTCS];
+    const struct drm_color_lut *lut[MAX_CRTCS];
+};
 
-        lut[i].red   = u16clamp(r * 65535.0);
-        lut[i].green = u16clamp(g * 65535.0);
-        lut[i].blue  = u16clamp(b * 65535.0);
+/* return: al's LUT of that size, NULL if it has none */
+static const struct drm_color_lut *luts_for(const struct apply_luts *al, uint32_t size) {
+    for (int k = 0; k < al->n; k++) {
+        if (al->size[k] == size) return al->lut[k];
     }
+    return NULL;
+}
 
-    uint32_t blob_id = 0;
-    int ret = drmModeCreatePropertyBlob(fd, lut, sizeof(*lut) * lut_size, &blob_id);
-    free(lut);
-    if (ret) { perror("drmModeCreatePropertyBlob"); return ret; }
-
-    drmModeAtomicReq *req = drmModeAtomicAlloc();
-    if (!req) {
-        fprintf(stderr, "drmModeAtomicAlloc failed\n");
-        drmModeDestroyPropertyBlob(fd, blob_id);
-        return -1;
+/* Add p's LUT for every lut_size of ci that al does not have yet.
+ * return: 0, -1 on allocation failure */
+static int build_luts(const struct crtc_info *ci, int n, const struct lut_params *p,
+                      const struct lut_opts *lo, struct apply_luts *al) {
+    for (int k = 0; k < n; k++) {
+        uint32_t size = ci[k].lut_size;
+        if (luts_for(al, size)) continue;
+        if (lo->file && lo->file->size == size) {
+            al->lut[al->n] = lo->file->lut;     /* the blob is created straight from the file */
+        } else {
+            struct drm_color_lut *lut = scratch(SCRATCH_LUT + al->n, sizeof(*lut) * size);
+            if (!lut) { perror("realloc(lut)"); return -1; }
+            if (cached_build_lut(lo, p, lut, size)) return -1;
+            al->lut[al->n] = lut;
+        }
+        al->size[al->n++] = size;
     }
+    return 0;
+}
 
-    ret = drmModeAtomicAddProperty(req, crtc_id, lut_prop, blob_id);
-    if (ret < 0) {
-        fprintf(stderr, "drmModeAtomicAddProperty failed: %d\n", ret);
-        drmModeAtomicFree(req);
-        drmModeDestroyPropertyBlob(fd, blob_id);
-        return ret;
-    }
+/* One-shot apply to n CRTCs in a single commit, of the LUTs in al. With
+ * DRM_MODE_PAGE_FLIP_EVENT in flags this returns only once the LUTs are on
+ * screen (needed with DRM_MODE_ATOMIC_NONBLOCK to know when they landed);
+ * without it a nonblocking commit returns immediately. */
+static int set_gamma_lut(int fd, const struct crtc_info *ci, int n, const struct lut_params *p,
+                         uint32_t flags, const struct apply_luts *al) {
+    const struct crtc_info *cp[MAX_CRTCS] = { NULL };
+    const struct drm_color_lut *lp[MAX_CRTCS] = { NULL };
+    const struct lut_params *color[MAX_CRTCS] = { NULL };
+    int ret;
 
-    ret = drmModeAtomicCommit(fd, req, 0, NULL);
-    if (ret) perror("drmModeAtomicCommit");
+    for (int k = 0; k < n; k++) {
+        cp[k] = &ci[k];
+        color[k] = p;
+        lp[k] = luts_for(al, ci[k].lut_size);
+    }
 
-    drmModeAtomicFree(req);
-    drmModeDestroyPropertyBlob(fd, blob_id);
+    int left = flip_events(cp, n);
+    ret = commit_gamma(fd, cp, lp, NULL, color, n, flags, &left);
+    if (!ret && (flags & DRM_MODE_PAGE_FLIP_EVENT)) ret = wait_flips(fd, &left);
     return ret;
 }
 
-/* ------------------- main ------------------- */
+/* Fade n CRTCs from the LUTs currently on screen to p's, as built in al.
+ * One frame is committed per vblank, for all CRTCs together; each commit
+ * requests flip events and the next frame is only built once they have all
+ * arrived, so a frame never sees two commits. Legacy CRTCs send no events;
+ * with only those, frames are paced by drmWaitVBlank() instead. */
+static int fade_gamma_lut(int fd, const struct crtc_info *ci, int n, const struct lut_params *p,
+                          uint32_t fade_ms, uint32_t flags, const struct apply_luts *al) {
+    const struct crtc_info *cp[MAX_CRTCS];
+    const struct drm_color_lut *fp[MAX_CRTCS], *to[MAX_CRTCS];
+    const struct lut_params *color[MAX_CRTCS];
+    struct drm_color_lut *from[MAX_CRTCS], *frame[MAX_CRTCS];
+    size_t total = 0;
+    for (int k = 0; k < n; k++) total += 2 * (size_t)ci[k].lut_size;
+    struct drm_color_lut *lut = scratch(SCRATCH_FADE, total * sizeof(*lut));
+    if (!lut) { perror("realloc(lut)"); return -1; }
 
-int main(int argc, char **argv) {
-    uint32_t crtc_id = DEFAULT_CRTC;
-    bool crtc_override = false;
-    const char *preset_path = NULL;
-    bool list_mode = false;
+    struct drm_color_lut *next = lut;
+    for (int k = 0; k < n; k++) {
+        uint32_t size = ci[k].lut_size;
+        cp[k] = &ci[k];
+        color[k] = p;
+        from[k] = next; frame[k] = next + size;
+        next += 2 * (size_t)size;
+        fp[k] = frame[k];
+        to[k] = luts_for(al, size);
 
-    int i = 1;
-    while (i < argc) {
-        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
-            print_usage(argv[0]);
-            return 0;
-        } else if (!strcmp(argv[i], "--list")) {
-            list_mode = true;
-            i++;
-        } else if (!strcmp(argv[i], "--crtc")) {
-            if (i + 1 >= argc) {
-                fprintf(stderr, "--crtc requires an argument.\n");
-                return 2;
-            }
-            uint32_t tmp = 0;
-            if (!parse_uint32(argv[i+1], &tmp)) {
-                fprintf(stderr, "Invalid --crtc value: %s\n", argv[i+1]);
-                print_usage(argv[0]); return 2;
-            }
-            crtc_id = tmp;
-            crtc_override = true;
-            i += 2;
-        } else if (!strcmp(argv[i], "--presets")) {
-            if (i + 1 >= argc) {
-                fprintf(stderr, "--presets requires a filepath argument.\n");
-                return 2;
-            }
-            preset_path = argv[i+1];
-            i += 2;
-        } else if (argv[i][0] == '-') {
-            fprintf(stderr, "Unknown option: %s\n", argv[i]);
-            print_usage(argv[0]);
-            return 2;
-        } else {
+        read_current_lut(fd, &ci[k], from[k]);
+    }
+
+    /* DEGAMMA_LUT and CTM switch with the first frame; only GAMMA_LUT fades */
+    int ret = 0;
+    bool first = true;
+    uint64_t t0 = now_ns(), period = FADE_FRAME_NS, flip_ns = 0;
+    for (double t = 0.0; t < 1.0; ) {
+        t = fade_progress(t0 - period, fade_ms);
+        for (int k = 0; k < n; k++) lerp_lut(from[k], to[k], frame[k], ci[k].lut_size, t);
+        int left = flip_events(cp, n);
+        ret = commit_gamma(fd, cp, fp, NULL, first ? color : NULL, n,
+                           flags | DRM_MODE_PAGE_FLIP_EVENT, &left);
+        if (!ret) ret = left ? wait_flips(fd, &left) : wait_vblanks(fd, ci[0].crtc_id, 1);
+        if (ret) {
+            /* No vblank events (inactive CRTC?): land on the target directly */
+            fprintf(stderr, "Fade aborted, applying target LUT directly.\n");
+            ret = commit_gamma(fd, cp, to, NULL, color, n, 0, NULL);
             break;
         }
+        /* One flip per frame from here on: their spacing is the period */
+        uint64_t now = now_ns();
+        if (flip_ns) period = now - flip_ns;
+        flip_ns = now;
+        first = false;
     }
+    return ret;
+}
 
-    if (!crtc_override) {
-        uint32_t config_crtc = 0;
-        int st = load_config_crtc(preset_path, &config_crtc);
-        if (st < 0) return 2;
-        if (st > 0) crtc_id = config_crtc;
+/* Drop the CRTCs that already show p (its LUTs in al, DEGAMMA_LUT and
+ * CTM, as read back from their blobs) from ci, recording their ids in same.
+ * return: the number of CRTCs left in ci */
+static int drop_unchanged(int fd, struct crtc_info *ci, int n, const struct lut_params *p,
+                          const struct apply_luts *al, uint32_t *same, int *nsame) {
+    int left = 0;
+    *nsame = 0;
+    for (int k = 0; k < n; k++) {
+        if (crtc_shows(fd, &ci[k], luts_for(al, ci[k].lut_size), p)) same[(*nsame)++] = ci[k].crtc_id;
+        else ci[left++] = ci[k];
     }
+    return left;
+}
 
-    if (list_mode) {
-        if (i != argc) {
-            fprintf(stderr, "--list does not take positional arguments.\n");
-            return 2;
-        }
-        list_all_presets(preset_path);
-        return 0;
+/* ------------- Request parsing ------------- */
+
+/* CRTCs named by --crtc (repeatable) and --output; "all" means every active
+ * CRTC with a GAMMA_LUT. Resolved against the topology once the card is open. */
+struct crtc_targets {
+    bool all;
+    bool is_default;            /* ids[0] is DEFAULT_CRTC or [config] crtc */
+    int n;
+    uint32_t ids[MAX_CRTCS];
+    int nout;
+    const char *outputs[MAX_OUTPUTS];
+};
+
+static bool parse_crtc_target(const char *s, struct crtc_targets *t) {
+    if (!strcmp(s, "all")) {
+        t->all = true;
+        return true;
+    }
+    uint32_t id = 0;
+    if (!parse_uint32(s, &id)) {
+        fprintf(stderr, "Invalid --crtc value: %s\n", s);
+        return false;
+    }
+    for (int k = 0; k < t->n; k++) {
+        if (t->ids[k] == id) return true;
+    }
+    if (t->n == MAX_CRTCS) {
+        fprintf(stderr, "Too many --crtc values (max %d)\n", MAX_CRTCS);
+        return false;
+    }
+    t->ids[t->n++] = id;
+    return true;
+}
+
+static bool parse_output_target(const char *s, struct crtc_targets *t) {
+    if (t->nout == MAX_OUTPUTS) {
+        fprintf(stderr, "Too many --output values (max %d)\n", MAX_OUTPUTS);
+        return false;
     }
+    t->outputs[t->nout++] = s;
+    return true;
+}
 
-    if (i >= argc) {
-        fprintf(stderr, "Missing arguments.\n");
-        print_usage(argv[0]); return 2;
+/* A preset's crtc key only redirects requests aimed at a single CRTC id */
+static bool crtc_targets_single(const struct crtc_targets *t) {
+    return !t->all && !t->nout && t->n == 1;
+}
+
+/* The board profile only knows DEFAULT_CRTC, and no outputs */
+static bool board_covers(const struct crtc_targets *t) {
+    if (t->all || t->nout) return false;
+    for (int k = 0; k < t->n; k++) {
+        if (t->ids[k] != DEFAULT_CRTC) return false;
     }
+    return true;
+}
 
-    /* Numeric path (<gamma> [lift gain r g b]) or preset-name */
-    double gamma_pow;
-    bool first_is_number = parse_double_strict(argv[i], &gamma_pow);
+static int add_target(const struct topology *topo, uint32_t crtc_id,
+                      struct crtc_info *ci, int n) {
+    for (int k = 0; k < n; k++) {
+        if (ci[k].crtc_id == crtc_id) return n;
+    }
+    const struct crtc_info *c = topology_crtc(topo, crtc_id);
+    if (!c) {
+        fprintf(stderr, "CRTC %u has no GAMMA_LUT/GAMMA_LUT_SIZE (see --outputs)\n", crtc_id);
+        return -1;
+    }
+    ci[n] = *c;
+    return n + 1;
+}
 
-    double lift = 0.0, gain = 1.0, r = 1.0, g = 1.0, b = 1.0;
+/* The CRTC driving an output, else the first active one with a GAMMA_LUT */
+static uint32_t fallback_crtc(const struct topology *topo) {
+    for (int k = 0; k < topo->nout; k++) {
+        if (topology_crtc(topo, topo->out[k].crtc_id)) return topo->out[k].crtc_id;
+    }
+    for (int k = 0; k < topo->ncrtc; k++) {
+        if (topo->crtc[k].active) return topo->crtc[k].crtc_id;
+    }
+    return 0;
+}
 
-    if (first_is_number) {
-        int remaining = argc - i;
-        if (remaining < 1 || remaining > 6) {
-            fprintf(stderr, "Invalid number of arguments (%d). Expected 1..6 after options.\n", remaining);
-            print_usage(argv[0]); return 2;
+/* Fill ci[] (at most MAX_CRTCS, no duplicates) with the CRTCs tg names. A
+ * default CRTC that does not exist on this board is replaced by the one
+ * discovery finds, instead of failing the commit.
+ * return: count, -1 on error */
+static int resolve_targets(const struct topology *topo, const struct crtc_targets *tg,
+                           struct crtc_info *ci) {
+    int n = 0;
+    if (tg->all) {
+        for (int k = 0; k < topo->ncrtc; k++) {
+            if (topo->crtc[k].active) ci[n++] = topo->crtc[k];
         }
-        if (gamma_pow < GAMMA_MIN || gamma_pow > GAMMA_MAX) {
-            fprintf(stderr, "gamma out of range: %g (%.2f..%.2f)\n", gamma_pow, GAMMA_MIN, GAMMA_MAX);
-            return 2;
-        }
-        int j = i + 1;
-        if (j < argc && !parse_double_in_range("lift", argv[j++], LIFT_MIN, LIFT_MAX, &lift)) return 2;
-        if (j < argc && !parse_double_in_range("gain", argv[j++], GAIN_MIN, GAIN_MAX, &gain)) return 2;
-        if (j < argc && !parse_double_in_range("r",    argv[j++], MULT_MIN, MULT_MAX, &r))    return 2;
-        if (j < argc && !parse_double_in_range("g",    argv[j++], MULT_MIN, MULT_MAX, &g))    return 2;
-        if (j < argc && !parse_double_in_range("b",    argv[j++], MULT_MIN, MULT_MAX, &b))    return 2;
-        if (j != argc) { fprintf(stderr, "Unexpected extra arguments.\n"); return 2; }
-    } else {
-        const char *preset = argv[i];
-        struct preset_vals pv;
-        int st = load_preset(preset, preset_path, &pv);
-        if (st == 0) {
-            fprintf(stderr, "Preset '%s' not found.\n", preset);
-            list_all_presets(preset_path);
-            return 2;
+        if (!n) fprintf(stderr, "No active CRTC with GAMMA_LUT found\n");
+        return n ? n : -1;
+    }
+    for (int k = 0; k < tg->nout && n >= 0; k++) {
+        int j = 0;
+        while (j < topo->nout && strcmp(topo->out[j].name, tg->outputs[k])) j++;
+        if (j == topo->nout) {
+            fprintf(stderr, "Output %s not found or not active (see --outputs)\n", tg->outputs[k]);
+            return -1;
         }
-        if (st < 0) {
-            fprintf(stderr, "Error parsing presets for '%s'.\n", preset);
-            return 2;
+        n = add_target(topo, topo->out[j].crtc_id, ci, n);
+    }
+    for (int k = 0; k < tg->n && n >= 0; k++) {
+        uint32_t crtc_id = tg->ids[k];
+        if (tg->is_default && !topology_crtc(topo, crtc_id)) {
+            uint32_t found = fallback_crtc(topo);
+            if (found) {
+                fprintf(stderr, "Default CRTC %u not found on %s, using CRTC %u\n",
+                        crtc_id, topo->card, found);
+                crtc_id = found;
+            }
         }
-        if (pv.have_crtc) crtc_id = pv.crtc;
-        if (!pv.have_gamma) { fprintf(stderr, "Preset '%s' lacks required key 'gamma'.\n", preset); return 2; }
-        gamma_pow = pv.gamma;
-        if (pv.have_lift) lift = pv.lift;
-        if (pv.have_gain) gain = pv.gain;
-        if (pv.have_r)    r = pv.r;
-        if (pv.have_g)    g = pv.g;
-        if (pv.have_b)    b = pv.b;
+        n = add_target(topo, crtc_id, ci, n);
     }
+    return n;
+}
 
-    /* Open DRM card */
-    int fd = -1;
-    for (int card = 0; card < 4; card++) {
-        char path[32];
-        snprintf(path, sizeof(path), "/dev/dri/card%d", card);
-        fd = open(path, O_RDWR | O_CLOEXEC);
-        if (fd >= 0) break;
-        if (errno == ENOENT) break;
+/* gamma --board-profile: the make variables of a board build for the
+ * target CRTC, from a fresh scan (make $(gamma --board-profile) ...) */
+static int run_board_profile(const struct crtc_targets *tg) {
+    struct topology topo;
+    int fd = open_topology(&topo, NULL, false);
+    if (fd < 0) return 1;
+
+    struct crtc_info ci[MAX_CRTCS];
+    uint32_t id[CP_COUNT];
+    uint64_t val[CP_COUNT];
+    int n = resolve_targets(&topo, tg, ci);
+    int ret = n > 0 ? 0 : 1;
+    if (n > 1) {
+        fprintf(stderr, "--board-profile takes a single --crtc or --output.\n");
+        ret = 2;
+    } else if (!ret && (ci[0].legacy || crtc_prop_ids(fd, ci[0].crtc_id, id, val))) {
+        fprintf(stderr, "CRTC %u has no atomic GAMMA_LUT, which a board build needs.\n", ci[0].crtc_id);
+        ret = 1;
+    }
+    if (!ret) {
+        printf("DEFAULT_CRTC=%u BOARD_CARD=%s BOARD_LUT_SIZE=%u BOARD_LUT_BITS=%u BOARD_PROPS=",
+               ci[0].crtc_id, topo.card, ci[0].lut_size, topo.lut_bits);
+        for (int k = 0; k < CP_COUNT; k++) printf("%s%u", k ? "," : "", id[k]);
+        printf("\n");
+    }
+    close(fd);
+#ifdef BOARD_CARD
+    struct topology bt;
+    int bfd = board_topology(&bt);
+    fprintf(stderr, "This build's profile (%s, CRTC %u) %s.\n", BOARD_CARD, DEFAULT_CRTC,
+            bfd >= 0 ? "matches" : "does not match; requests use discovery");
+    if (bfd >= 0) close(bfd);
+#endif
+    return ret;
+}
+
+/* Resolve positional arguments (<gamma_pow> [lift gain r g b] or <preset-name>)
+ * into LUT parameters. A preset's own crtc= key overrides *crtc_id.
+ * argv0 is used for usage/help output; pass NULL to keep quiet (daemon).
+ * return: 0=ok, 2=bad arguments (message already printed) */
+static int resolve_params(int argc, char **argv, const char *preset_path,
+                          const char *argv0, struct lut_params *p, uint32_t *crtc_id) {
+    *p = (struct lut_params){ .gain = 1.0, .r = 1.0, .g = 1.0, .b = 1.0 };
+
+    if (argc < 1) {
+        fprintf(stderr, "Missing arguments.\n");
+        if (argv0) print_usage(argv0);
+        return 2;
+    }
+
+    /* Numeric path (<gamma> [lift gain r g b]) or preset-name */
+    if (parse_double_strict(argv[0], &p->gamma)) {
+        if (argc > 6) {
+            fprintf(stderr, "Invalid number of arguments (%d). Expected 1..6 after options.\n", argc);
+            if (argv0) print_usage(argv0);
+            return 2;
+        }
+        if (p->gamma < GAMMA_MIN || p->gamma > GAMMA_MAX) {
+            fprintf(stderr, "gamma out of range: %g (%.2f..%.2f)\n", p->gamma, GAMMA_MIN, GAMMA_MAX);
+            return 2;
+        }
+        int j = 1;
+        if (j < argc && !parse_double_in_range("lift", argv[j++], LIFT_MIN, LIFT_MAX, &p->lift)) return 2;
+        if (j < argc && !parse_double_in_range("gain", argv[j++], GAIN_MIN, GAIN_MAX, &p->gain)) return 2;
+        if (j < argc && !parse_double_in_range("r",    argv[j++], MULT_MIN, MULT_MAX, &p->r))    return 2;
+        if (j < argc && !parse_double_in_range("g",    argv[j++], MULT_MIN, MULT_MAX, &p->g))    return 2;
+        if (j < argc && !parse_double_in_range("b",    argv[j++], MULT_MIN, MULT_MAX, &p->b))    return 2;
+        return 0;
+    }
+
+    const char *preset = argv[0];
+
+    struct preset_vals pv;
+    int st = load_preset(preset, preset_path, &pv);
+    if (st == 0) {
+        fprintf(stderr, "Preset '%s' not found.\n", preset);
+        if (argv0) list_all_presets(preset_path);
+        return 2;
+    }
+    if (st < 0) {
+        fprintf(stderr, "Error parsing presets for '%s'.\n", preset);
+        return 2;
+    }
+    if (pv.have_crtc) *crtc_id = pv.crtc;
+    if (!preset_to_params(&pv, p)) { fprintf(stderr, "Preset '%s' lacks required key 'gamma'.\n", preset); return 2; }
+    return 0;
+}
+
+/* --blend <A> <B> <t>: A and B are presets (or plain gamma values), t the
+ * weight of B in 0..1. A preset's crtc= key is ignored.
+ * return: 0=ok, 2=bad arguments (message already printed) */
+static int resolve_blend(char *const *args, const char *preset_path, const char *argv0,
+                         struct lut_blend *bl) {
+    uint32_t crtc_id = 0;
+    if (!parse_double_strict(args[2], &bl->t) || bl->t < 0.0 || bl->t > 1.0) {
+        fprintf(stderr, "Invalid --blend weight: %s (0..1)\n", args[2]);
+        return 2;
     }
-    if (fd < 0) { perror("open /dev/dri/cardN"); return 1; }
+    int st = resolve_params(1, (char **)&args[0], preset_path, argv0, &bl->a, &crtc_id);
+    if (!st) st = resolve_params(1, (char **)&args[1], preset_path, argv0, &bl->b, &crtc_id);
+    return st;
+}
+
+/* ---------------- Batch ---------------- */
+
+#define BATCH_MAX_ARGS   12
+#define BATCH_LINE_MAX   512
+#define BATCH_HOLD_MAX_MS 3600000
+#define BATCH_VBLANK_MAX 1000
 
-    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+/* One open card and topology, reused for every apply of a run */
+struct apply_ctx {
+    int fd;                      /* -1 once a rescan failed */
+    struct topology topo;
+    const char *topo_cache;
+    bool board;                  /* open_topology() may use the board profile */
+    uint32_t fade_ms, flags;
+    bool force, wait;
+    const struct lut_opts *lo;
+};
+
+/* Apply p to the CRTCs of tg, skipping those that already show it (unless
+ * --force), and report "unchanged"/"landed" lines on stdout.
+ * return: exit-style status (0=ok, 1=DRM failure) */
+static int apply_params(struct apply_ctx *a, const struct crtc_targets *tg, const struct lut_params *p) {
+    struct crtc_info ci[MAX_CRTCS];
+    struct apply_luts al = { 0 };
+    uint32_t same[MAX_CRTCS];
+    int n, nsame = 0, ret;
+    uint64_t t0 = now_ns();
+    for (;;) {
+        n = resolve_targets(&a->topo, tg, ci);
+        ret = n > 0 ? 0 : -1;
+        /* Fades start from the LUT on screen, which the cache cannot know */
+        for (int k = 0; k < n && a->fade_ms && a->topo.cached && !ret; k++) {
+            ret = probe_crtc(a->fd, ci[k].crtc_id, &ci[k]);
+        }
+        /* Nor does it know the blobs on screen for the dirty check */
+        for (int k = 0; k < n && !a->force && !a->fade_ms && a->topo.cached && !ret; k++) {
+            ret = read_crtc_blobs(a->fd, &ci[k]);
+        }
+        if (!ret) ret = build_luts(ci, n, p, a->lo, &al);
+        if (!ret && !a->force) n = drop_unchanged(a->fd, ci, n, p, &al, same, &nsame);
+        if (!ret && !n) break;
+        if (!ret) ret = a->fade_ms ? fade_gamma_lut(a->fd, ci, n, p, a->fade_ms, a->flags, &al)
+                                   : set_gamma_lut(a->fd, ci, n, p, a->flags, &al);
+        if (!ret || !(a->topo.cached || a->topo.board)) break;
 
-    int ret = set_gamma_lut(fd, crtc_id, gamma_pow, lift, gain, r, g, b);
+        /* The cached topology may be stale (hotplug, modeset): rescan once */
+        fprintf(stderr, "Rescanning DRM topology.\n");
+        if (a->topo.board) a->board = false;
+        else unlink(a->topo_cache);
+        close(a->fd);
+        al.n = 0;                /* the LUT sizes may have changed too */
+        a->fd = open_topology(&a->topo, a->topo_cache, a->board);
+        if (a->fd < 0) return 1;
+    }
+    if (!ret && nsame) {
+        printf("unchanged crtc=");
+        for (int k = 0; k < nsame; k++) printf("%s%u", k ? "," : "", same[k]);
+        printf("\n");
+    }
     if (ret) fprintf(stderr, "set_gamma_lut failed: %d\n", ret);
+    else if (a->wait && n) {
+        printf("landed crtc=");
+        for (int k = 0; k < n; k++) printf("%s%u", k ? "," : "", ci[k].crtc_id);
+        printf(" after %llu us\n", (unsigned long long)((now_ns() - t0) / 1000));
+    }
+    return ret ? 1 : 0;
+}
+
+/* --batch: one step per line, all in this process on one fd:
+ *   <gamma_pow> [lift gain r g b] | <preset-name>   [hold <ms>] [vblank <N>]
+ * hold sleeps after the step, vblank waits for N vblanks of its first CRTC;
+ * either may also stand alone. Blank lines and '#' comments are skipped.
+ * return: exit-style status of the first failing line, 0 if all succeed */
+static int run_batch(struct apply_ctx *a, const char *path, const struct crtc_targets *targets,
+                     const char *preset_path) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    char line[BATCH_LINE_MAX];
+    int lineno = 0, st = 0;
+    while (!st && fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(f)) {
+            fprintf(stderr, "line %d: too long\n", lineno);
+            st = 2;
+            break;
+        }
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *av[BATCH_MAX_ARGS];
+        int ac = 0;
+        char *save = NULL;
+        for (char *tok = strtok_r(line, " \t\r\n", &save); tok && !st; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            if (ac == BATCH_MAX_ARGS) { fprintf(stderr, "line %d: too many arguments\n", lineno); st = 2; }
+            else av[ac++] = tok;
+        }
+
+        uint32_t hold_ms = 0, vblanks = 0;
+        while (!st && ac >= 2 && (!strcmp(av[ac-2], "hold") || !strcmp(av[ac-2], "vblank"))) {
+            bool hold = av[ac-2][0] == 'h';
+            uint32_t v;
+            if (!parse_uint32(av[ac-1], &v) || v > (hold ? BATCH_HOLD_MAX_MS : BATCH_VBLANK_MAX)) {
+                fprintf(stderr, "line %d: invalid %s value: %s (0..%d)\n", lineno, av[ac-2], av[ac-1],
+                        hold ? BATCH_HOLD_MAX_MS : BATCH_VBLANK_MAX);
+                st = 2;
+            }
+            if (hold) hold_ms = v;
+            else vblanks = v;
+            ac -= 2;
+        }
+        if (st || (!ac && !hold_ms && !vblanks)) continue;
+
+        /* Same target rule as the command line: a preset's crtc= key
+         * redirects a single CRTC */
+        struct crtc_targets tg = *targets;
+        if (ac) {
+            struct lut_params p;
+            uint32_t crtc_id = tg.ids[0];
+            st = resolve_params(ac, av, preset_path, NULL, &p, &crtc_id);
+            if (st) { fprintf(stderr, "line %d: rejected\n", lineno); break; }
+            if (crtc_targets_single(&tg) && crtc_id != tg.ids[0]) {
+                tg.ids[0] = crtc_id;
+                tg.is_default = false;
+            }
+            st = apply_params(a, &tg, &p);
+            if (st) { fprintf(stderr, "line %d: failed\n", lineno); break; }
+        }
+        if (vblanks) {
+            struct crtc_info ci[MAX_CRTCS];
+            if (resolve_targets(&a->topo, &tg, ci) <= 0 || wait_vblanks(a->fd, ci[0].crtc_id, vblanks)) {
+                fprintf(stderr, "line %d: vblank wait failed\n", lineno);
+                st = 1;
+                break;
+            }
+        }
+        if (hold_ms) {
+            struct timespec ts = { .tv_sec = hold_ms / 1000, .tv_nsec = (long)(hold_ms % 1000) * 1000000 };
+            while (nanosleep(&ts, &ts) && errno == EINTR) {}
+        }
+        /* A script driving us through a pipe reads each step's report */
+        fflush(stdout);
+    }
+    if (f != stdin) fclose(f);
+    return st;
+}
+
+/* ---------------- Compile ---------------- */
+
+#define DB_MAX_LUT_SIZES 8
+#define DB_LUT_SIZE_MAX  4096
+
+struct db_preset {
+    char name[INI_NAME_MAX + 1];
+    struct preset_vals vals;
+    uint32_t pos;                /* source order */
+};
+
+static int cmp_db_preset(const void *a, const void *b) {
+    return strcmp(((const struct db_preset *)a)->name, ((const struct db_preset *)b)->name);
+}
+
+static int cmp_db_lut(const void *a, const void *b) {
+    uint64_t x = ((const struct preset_db_lut *)a)->key, y = ((const struct preset_db_lut *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+/* "256,1024" */
+static bool parse_lut_sizes(const char *s, uint32_t *sizes, int *n) {
+    char buf[128];
+    if (strlen(s) >= sizeof(buf)) return false;
+    strcpy(buf, s);
+    *n = 0;
+    for (char *save = NULL, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        uint32_t v;
+        if (*n == DB_MAX_LUT_SIZES || !parse_uint32(tok, &v) || v < 2 || v > DB_LUT_SIZE_MAX) return false;
+        sizes[(*n)++] = v;
+    }
+    return *n > 0;
+}
+
+static size_t align8(size_t x) {
+    return (x + 7) & ~(size_t)7;
+}
+
+/* Collect the presets of f in source order, each validated exactly as a
+ * lookup would. return: count, or -1 after reporting every bad preset */
+static int compile_presets(const struct ini_file *f, struct db_preset *ps) {
+    int n = 0, errors = 0;
+    for (int i = 0; i < f->nsec; i++) {
+        const struct ini_section *s = &f->sec[i];
+        if (!s->name.len || span_eq(s->name, "config")) continue;
+        char name[INI_NAME_MAX + 1];
+        span_str(s->name, name, sizeof(name));
+        bool dup = false;
+        for (int k = 0; k < n && !dup; k++) dup = !strcmp(ps[k].name, name);
+        if (dup) continue;              /* merged by index_preset() */
+
+        struct db_preset *d = &ps[n];
+        memset(d, 0, sizeof(*d));       /* also zeroes padding written to disk */
+        int st = index_preset(f, name, &d->vals);
+        if (st < 0) {
+            fprintf(stderr, "Error parsing presets for '%s'.\n", name);
+            errors++;
+        } else if (st > 0 && !preset_to_params(&d->vals, &(struct lut_params){ 0 })) {
+            fprintf(stderr, "Preset '%s' lacks required key 'gamma'.\n", name);
+            errors++;
+        } else if (st > 0) {
+            strcpy(d->name, name);
+            d->pos = (uint32_t)n++;
+        }
+    }
+    return errors ? -1 : n;
+}
+
+static bool write_all(int fd, const char *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* -o <name>.h: the database as a C array, for a board build (BOARD_PRESETS
+ * in the Makefile). Same bytes as the .bin, so the layout is the
+ * generator's; db_valid() still checks it in the built binary. */
+static bool write_db_header(int fd, const char *src, const char *db, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[4096];
+    int n = snprintf(buf, sizeof(buf),
+                     "// Generated by gamma --compile %s; do not edit.\n\n"
+                     "#define BOARD_DB_LEN %zuu\n\n"
+                     "static const unsigned char board_db[] __attribute__((aligned(8))) = {\n",
+                     src, len);
+    if (n < 0 || (size_t)n >= sizeof(buf) / 2) return false;
+    size_t at = (size_t)n;
+    for (size_t k = 0; k < len; k++) {
+        unsigned char c = (unsigned char)db[k];
+        if (k % 16 == 0) buf[at++] = ' ';
+        memcpy(buf + at, " 0x", 3);
+        buf[at + 3] = hex[c >> 4];
+        buf[at + 4] = hex[c & 15];
+        buf[at + 5] = ',';
+        at += 6;
+        if (k % 16 == 15 || k + 1 == len) buf[at++] = '\n';
+        if (at > sizeof(buf) - 128) {
+            if (!write_all(fd, buf, at)) return false;
+            at = 0;
+        }
+    }
+    memcpy(buf + at, "};\n", 3);
+    return write_all(fd, buf, at + 3);
+}
+
+/* gamma --compile: validate src once and write it to out as a preset
+ * database (tmp file + rename), with LUTs prebuilt for every lut size. */
+static int run_compile(const char *src, const char *out, const uint32_t *sizes, int nsizes,
+                       const struct lut_opts *lo) {
+    struct ini_file f = { 0 };
+    struct db_preset *ps = NULL;
+    char *buf = NULL;
+    int ret = 2;
+
+    ini_map(&f, src);
+    if (!f.present || f.db) {
+        fprintf(stderr, f.db ? "%s is already a compiled preset database.\n" : "Cannot read %s\n", src);
+        goto out;
+    }
+    if (!ini_index(&f) || !(ps = calloc((size_t)f.nsec + 1, sizeof(*ps)))) {
+        fprintf(stderr, "Out of memory compiling %s\n", src);
+        goto out;
+    }
+    int n = compile_presets(&f, ps);
+    uint32_t config_crtc = 0;
+    int cst = index_config_crtc(&f, &config_crtc);
+    if (n < 0 || cst < 0) {
+        fprintf(stderr, "%s not written.\n", out);
+        goto out;
+    }
+    qsort(ps, (size_t)n, sizeof(*ps), cmp_db_preset);
+
+    /* header | entries | order | names | LUT table | LUT data */
+    size_t names_len = 0, lut_bytes = 0;
+    for (int k = 0; k < n; k++) names_len += strlen(ps[k].name) + 1;
+    for (int z = 0; z < nsizes; z++) lut_bytes += (size_t)n * sizes[z] * sizeof(struct drm_color_lut);
+    uint32_t nluts = (uint32_t)(n * nsizes);
+    size_t entries_off = align8(sizeof(struct preset_db_hdr));
+    size_t order_off = entries_off + (size_t)n * sizeof(struct preset_db_entry);
+    size_t names_off = order_off + (size_t)n * sizeof(uint32_t);
+    size_t luts_off = align8(names_off + names_len);
+    size_t data_off = luts_off + nluts * sizeof(struct preset_db_lut);
+    size_t total = data_off + lut_bytes;
+    if (!(buf = calloc(1, total))) {
+        fprintf(stderr, "Out of memory compiling %s\n", src);
+        goto out;
+    }
+
+    struct preset_db_hdr *h = (void *)buf;
+    *h = (struct preset_db_hdr){
+        .magic = { 'G', 'P', 'D', 'B' },
+        .version = PRESET_DB_VERSION,
+        .vals_size = sizeof(struct preset_vals),
+        .lut_entry_size = sizeof(struct preset_db_lut),
+        .count = (uint32_t)n,
+        .nluts = nluts,
+        .has_config = cst > 0,
+        .config_crtc = config_crtc,
+        .entries_off = entries_off,
+        .order_off = order_off,
+        .names_off = names_off,
+        .names_len = names_len,
+        .luts_off = luts_off,
+    };
+    struct preset_db_entry *ent = (void *)(buf + entries_off);
+    uint32_t *order = (void *)(buf + order_off);
+    struct preset_db_lut *luts = (void *)(buf + luts_off);
+    size_t name_at = 0, data_at = data_off;
+    for (int k = 0; k < n; k++) {
+        ent[k].name_off = (uint32_t)name_at;
+        ent[k].vals = ps[k].vals;
+        strcpy(buf + names_off + name_at, ps[k].name);
+        name_at += strlen(ps[k].name) + 1;
+        order[ps[k].pos] = (uint32_t)k;
+
+        struct lut_params p;
+        preset_to_params(&ps[k].vals, &p);
+        for (int z = 0; z < nsizes; z++) {
+            struct preset_db_lut *l = &luts[k * nsizes + z];
+            *l = (struct preset_db_lut){
+                .key = lut_key(&p, sizes[z], lut_variant(lo)), .off = data_at,
+                .params = p, .lut_size = sizes[z], .kernel = lut_variant(lo),
+            };
+            build_lut_opts(lo, &p, (struct drm_color_lut *)(buf + data_at), sizes[z]);
+            l->sum = lut_sum((const struct drm_color_lut *)(buf + data_at), sizes[z]);
+            data_at += sizes[z] * sizeof(struct drm_color_lut);
+        }
+    }
+    qsort(luts, nluts, sizeof(*luts), cmp_db_lut);
+
+    char tmp[PATH_MAX];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d.tmp", out, (int)getpid()) >= sizeof(tmp)) {
+        fprintf(stderr, "Output path too long: %s\n", out);
+        goto out;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(tmp);
+        ret = 1;
+        goto out;
+    }
+    size_t olen = strlen(out);
+    bool ok = olen > 2 && !strcmp(out + olen - 2, ".h") ? write_db_header(fd, src, buf, total)
+                                                         : write_all(fd, buf, total);
+    if (close(fd) < 0) ok = false;
+    if (!ok || rename(tmp, out) < 0) {
+        perror(out);
+        unlink(tmp);
+        ret = 1;
+        goto out;
+    }
+    printf("Compiled %d presets from %s into %s", n, src, out);
+    if (nluts) printf(" (%u prebuilt LUTs)", nluts);
+    printf("\n");
+    ret = 0;
+
+out:
+    free(buf);
+    free(ps);
+    free(f.sec);
+    free(f.ent);
+    ini_unmap(&f);
+    return ret;
+}
+
+/* ----------------- Boot ----------------- */
+
+/* gamma --save-boot <file> <preset ...> snapshots everything a commit needs
+ * (card path, CRTC and property IDs, finished blob payloads); gamma --boot
+ * <file> replays it with no INI, no card probing and no property scan:
+ * read, open, one blob per property, one commit. */
+#define BOOT_VERSION  1
+#define BOOT_MAX_PROPS (3 * MAX_CRTCS)
+#define BOOT_WAIT_MS  2000       /* for the card node to appear */
+#define BOOT_FILE_MAX (1u << 20)
+
+struct boot_hdr {
+    char magic[4];               /* "GBOT" */
+    uint32_t version;
+    char card[32];
+    uint32_t nprops;
+    uint32_t reserved;
+};
+
+/* Followed by len payload bytes, padded to 8; len 0 = property set to 0 */
+struct boot_prop {
+    uint32_t crtc_id;
+    uint32_t prop_id;            /* 0: legacy gamma ramp (drmModeCrtcSetGamma) */
+    uint32_t len;
+    uint32_t reserved;
+};
+
+static int boot_add(char *buf, size_t *at, uint32_t crtc_id, uint32_t prop_id,
+                    const void *data, size_t len) {
+    size_t need = sizeof(struct boot_prop) + ((len + 7) & ~(size_t)7);
+    if (*at + need > BOOT_FILE_MAX) {
+        fprintf(stderr, "Boot snapshot too large.\n");
+        return -1;
+    }
+    struct boot_prop bp = { .crtc_id = crtc_id, .prop_id = prop_id, .len = (uint32_t)len };
+    memcpy(buf + *at, &bp, sizeof(bp));
+    if (len) memcpy(buf + *at + sizeof(bp), data, len);
+    *at += need;
+    return 0;
+}
+
+/* GAMMA_LUT lut, and DEGAMMA_LUT/CTM for p where the CRTC has them.
+ * scratch: room for a degamma LUT, may be lut (copied in first).
+ * return: 0, -1 if the snapshot is full */
+static int boot_add_crtc(char *buf, size_t *at, struct boot_hdr *h, const struct crtc_info *ci,
+                         const struct drm_color_lut *lut, const struct lut_params *p,
+                         struct drm_color_lut *scratch) {
+    uint32_t id = ci->crtc_id;
+    if (boot_add(buf, at, id, ci->legacy ? 0 : ci->lut_prop, lut, sizeof(*lut) * ci->lut_size)) return -1;
+    h->nprops++;
+    if (ci->degamma_prop) {
+        if (p->degamma) build_degamma(p, scratch, ci->degamma_size);
+        if (boot_add(buf, at, id, ci->degamma_prop, scratch,
+                     p->degamma ? sizeof(*scratch) * ci->degamma_size : 0)) return -1;
+        h->nprops++;
+    }
+    if (ci->ctm_prop) {
+        struct drm_color_ctm m;
+        build_ctm(p, &m);
+        if (boot_add(buf, at, id, ci->ctm_prop, &m, ctm_set(p) ? sizeof(m) : 0)) return -1;
+        h->nprops++;
+    }
+    return 0;
+}
+
+/* Write the snapshot in buf[0..at) with header h to path (tmp file + rename).
+ * return: 0, -1 on error (reported) */
+static int boot_write(const char *path, char *buf, size_t at, const struct boot_hdr *h) {
+    memcpy(buf, h, sizeof(*h));
+
+    char tmp[PATH_MAX];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= sizeof(tmp)) {
+        fprintf(stderr, "Path too long: %s\n", path);
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { fprintf(stderr, "%s: %s\n", tmp, strerror(errno)); return -1; }
+    bool ok = write_all(fd, buf, at) && fsync(fd) == 0;
+    if (close(fd) || !ok || rename(tmp, path)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* The LUTs for p on every CRTC in ci, saved to path.
+ * return: exit-style status */
+static int save_boot(const char *path, const char *card, const struct crtc_info *ci, int n,
+                     const struct lut_params *p, const struct lut_opts *lo) {
+    char *buf = calloc(1, BOOT_FILE_MAX);
+    struct drm_color_lut *lut = calloc(LUT_FILE_MAX, sizeof(*lut));
+    struct boot_hdr h = { .magic = { 'G', 'B', 'O', 'T' }, .version = BOOT_VERSION };
+    size_t at = sizeof(h);
+    int ret = 1;
+    if (!buf || !lut) { perror("calloc"); goto out; }
+    snprintf(h.card, sizeof(h.card), "%s", card);
+
+    for (int k = 0; k < n; k++) {
+        if (cached_build_lut(lo, p, lut, ci[k].lut_size)) goto out;
+        if (boot_add_crtc(buf, &at, &h, &ci[k], lut, p, lut)) goto out;
+    }
+    if (boot_write(path, buf, at, &h)) goto out;
+    printf("Saved boot LUT for crtc=");
+    for (int k = 0; k < n; k++) printf("%s%u", k ? "," : "", ci[k].crtc_id);
+    printf(" on %s to %s\n", card, path);
+    ret = 0;
+out:
+    free(lut);
+    free(buf);
+    return ret;
+}
+
+/* gamma --boot: replay a --save-boot snapshot.
+ * return: exit-style status (2 = unusable snapshot, 1 = DRM failure) */
+static int run_boot(const char *path) {
+    uint64_t t0 = now_ns();
+    int f = open(path, O_RDONLY | O_CLOEXEC);
+    if (f < 0) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return 2; }
+    char *buf = malloc(BOOT_FILE_MAX);
+    ssize_t len = buf ? read(f, buf, BOOT_FILE_MAX) : -1;
+    close(f);
 
+    struct boot_hdr h;
+    if (len < (ssize_t)sizeof(h)) {
+        fprintf(stderr, "%s: not a boot snapshot\n", path);
+        free(buf);
+        return 2;
+    }
+    memcpy(&h, buf, sizeof(h));
+    if (memcmp(h.magic, "GBOT", 4) || h.version != BOOT_VERSION || h.nprops > BOOT_MAX_PROPS ||
+        !memchr(h.card, '\0', sizeof(h.card))) {
+        fprintf(stderr, "%s: not a boot snapshot from this version\n", path);
+        free(buf);
+        return 2;
+    }
+
+    /* Early in boot the card node may still be on its way */
+    int fd = -1;
+    for (int waited = 0; (fd = open_card_path(h.card)) < 0 && errno == ENOENT && waited < BOOT_WAIT_MS; waited += 5) {
+        usleep(5000);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", h.card, strerror(errno));
+        free(buf);
+        return 1;
+    }
+
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    uint32_t blobs[BOOT_MAX_PROPS], crtcs[MAX_CRTCS];
+    size_t ramps[BOOT_MAX_PROPS];
+    int nblobs = 0, nramps = 0, natomic = 0, ncrtc = 0, ret = req ? 0 : -1;
+    size_t at = sizeof(h);
+    for (uint32_t k = 0; k < h.nprops && !ret; k++) {
+        struct boot_prop bp;
+        if ((size_t)len - at < sizeof(bp)) { ret = -2; break; }
+        memcpy(&bp, buf + at, sizeof(bp));
+        at += sizeof(bp);
+        if ((size_t)len - at < bp.len) { ret = -2; break; }
+
+        uint32_t id = 0;
+        if (!bp.prop_id) {
+            if (bp.len < 2 * sizeof(struct drm_color_lut)) { ret = -2; break; }
+            ramps[nramps++] = at - sizeof(bp);
+        } else if (bp.len) {
+            if (create_blob(fd, buf + at, bp.len, &id)) { perror("drmModeCreatePropertyBlob"); ret = -1; break; }
+            blobs[nblobs++] = id;
+        }
+        at += ((size_t)bp.len + 7) & ~(size_t)7;
+        if (bp.prop_id && drmModeAtomicAddProperty(req, bp.crtc_id, bp.prop_id, id) < 0) ret = -1;
+        natomic += bp.prop_id != 0;
+
+        bool seen = false;
+        for (int j = 0; j < ncrtc; j++) seen |= crtcs[j] == bp.crtc_id;
+        if (!seen && ncrtc < MAX_CRTCS) crtcs[ncrtc++] = bp.crtc_id;
+    }
+    if (ret == -2) fprintf(stderr, "%s: truncated boot snapshot\n", path);
+    if (!ret && natomic) {
+        ret = drmModeAtomicCommit(fd, req, 0, NULL);
+        if (ret) perror("drmModeAtomicCommit");
+    }
+    for (int k = 0; k < nramps && !ret; k++) {
+        struct boot_prop bp;
+        memcpy(&bp, buf + ramps[k], sizeof(bp));
+        struct crtc_info ci = { .crtc_id = bp.crtc_id, .lut_size = bp.len / sizeof(struct drm_color_lut),
+                                .legacy = true };
+        ret = legacy_commit(fd, &ci, (const struct drm_color_lut *)(buf + ramps[k] + sizeof(bp)), 0);
+    }
+    if (req) drmModeAtomicFree(req);
+    for (int k = 0; k < nblobs; k++) drmModeDestroyPropertyBlob(fd, blobs[k]);
+    close(fd);
+    free(buf);
+    if (ret) return ret == -2 ? 2 : 1;
+
+    struct timespec up;
+    clock_gettime(CLOCK_BOOTTIME, &up);
+    printf("boot: crtc=");
+    for (int k = 0; k < ncrtc; k++) printf("%s%u", k ? "," : "", crtcs[k]);
+    printf(" applied in %llu us, %ld.%03ld s after boot\n",
+           (unsigned long long)((now_ns() - t0) / 1000), (long)up.tv_sec, up.tv_nsec / 1000000);
+    return 0;
+}
+
+/* ---------------- Verify ---------------- */
+
+struct verify_stats {
+    const char *preset_path;
+    int luts;
+    uint64_t values, differ;
+    int max_err;
+    struct lut_params worst;
+    uint32_t worst_size, worst_entry;
+};
+
+static void verify_params(struct verify_stats *vs, const struct lut_params *p) {
+    static const uint32_t sizes[] = { 17, 256, 1024, 4096 };
+    static struct drm_color_lut ref[4096], fast[4096];
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        uint32_t n = sizes[k];
+        build_lut(p, ref, n);
+        build_lut_fast(p, fast, n);
+        vs->luts++;
+        for (uint32_t i = 0; i < n; i++) {
+            int d[3] = {
+                abs((int)ref[i].red - (int)fast[i].red),
+                abs((int)ref[i].green - (int)fast[i].green),
+                abs((int)ref[i].blue - (int)fast[i].blue),
+            };
+            for (int c = 0; c < 3; c++) {
+                vs->values++;
+                if (!d[c]) continue;
+                vs->differ++;
+                if (d[c] > vs->max_err) {
+                    vs->max_err = d[c];
+                    vs->worst = *p;
+                    vs->worst_size = n;
+                    vs->worst_entry = i;
+                }
+            }
+        }
+    }
+}
+
+static void verify_preset(const char *name, void *ctx) {
+    struct verify_stats *vs = ctx;
+    struct preset_vals pv;
+    struct lut_params p;
+    if (load_preset(name, vs->preset_path, &pv) == 1 && preset_to_params(&pv, &p)) {
+        verify_params(vs, &p);
+    }
+}
+
+/* Diff the fast kernel against build_lut() over every preset plus a grid
+ * spanning the allowed parameter ranges. return: exit status */
+static int run_verify(const char *preset_path) {
+    static const double gammas[] = { GAMMA_MIN, 0.2, 0.45, 0.8, 1.0, 1.5, 2.2, 3.0, GAMMA_MAX };
+    static const double lifts[]  = { LIFT_MIN, -0.15, 0.0, 0.1, LIFT_MAX };
+    static const double gains[]  = { GAIN_MIN, 0.5, 1.0, 2.75, GAIN_MAX };
+    static const double mults[]  = { MULT_MIN, 0.5, 1.0, 1.35, MULT_MAX };
+    struct verify_stats vs = { .preset_path = preset_path };
+
+    for (size_t a = 0; a < sizeof(gammas) / sizeof(gammas[0]); a++)
+    for (size_t b = 0; b < sizeof(lifts) / sizeof(lifts[0]); b++)
+    for (size_t c = 0; c < sizeof(gains) / sizeof(gains[0]); c++)
+    for (size_t m = 0; m < sizeof(mults) / sizeof(mults[0]); m++) {
+        struct lut_params p = {
+            .gamma = gammas[a], .lift = lifts[b], .gain = gains[c],
+            .r = mults[m], .g = 1.0, .b = mults[sizeof(mults) / sizeof(mults[0]) - 1 - m],
+        };
+        verify_params(&vs, &p);
+
+        /* Same point with blue on its own gamma and red on its own lift */
+        p.ch[0][2] = gammas[sizeof(gammas) / sizeof(gammas[0]) - 1 - a];
+        p.ch[1][0] = lifts[sizeof(lifts) / sizeof(lifts[0]) - 1 - b];
+        p.ch_set = 1ull << (3 * 0 + 2) | 1ull << (3 * 1 + 0);
+        verify_params(&vs, &p);
+    }
+    verify_preset("reset", &vs);
+    foreach_preset(preset_path, verify_preset, &vs);
+
+    printf("Fast kernel (%s) vs double reference: max error %d LSB (limit %d)\n",
+           LUT_FAST_IMPL, vs.max_err, LUT_FAST_MAX_ERR);
+    printf("  %d LUTs, %llu of %llu channel values differ\n", vs.luts,
+           (unsigned long long)vs.differ, (unsigned long long)vs.values);
+    if (vs.max_err) {
+        printf("  worst: gamma=%g lift=%g gain=%g r=%g g=%g b=%g size=%u entry=%u\n",
+               vs.worst.gamma, vs.worst.lift, vs.worst.gain,
+               vs.worst.r, vs.worst.g, vs.worst.b, vs.worst_size, vs.worst_entry);
+        for (int f = 0; f < 3; f++) {
+            for (int c = 0; c < 3; c++) {
+                if (vs.worst.ch_set & (1ull << (3 * f + c))) {
+                    printf("  worst: %s=%g\n", ch_keys[f][c], vs.worst.ch[f][c]);
+                }
+            }
+        }
+    }
+    return vs.max_err > LUT_FAST_MAX_ERR ? 1 : 0;
+}
+
+/* ----------------- Dump ----------------- */
+
+enum dump_format {
+    DUMP_SUMMARY,                /* one line per CRTC: the LUT's sum and its preset */
+    DUMP_CSV,                    /* "r,g,b" lines, as --lut-file reads them */
+    DUMP_RAW,                    /* the struct drm_color_lut entries */
+};
+
+static const char *const dump_format_names[] = { "summary", "csv", "raw" };
+
+static bool parse_dump_format(const char *s, enum dump_format *fmt) {
+    for (int k = 0; k < 3; k++) {
+        if (!strcmp(s, dump_format_names[k])) {
+            *fmt = (enum dump_format)k;
+            return true;
+        }
+    }
+    fprintf(stderr, "--dump-format takes summary, csv or raw.\n");
+    return false;
+}
+
+/* A preset whose LUT sum is known without building anything: from a
+ * compiled database's table or a LUT cache file's header */
+struct dump_sum {
+    uint64_t sum;
+    int order;                   /* search order, "reset" first */
+    struct lut_params params;
+    char name[INI_NAME_MAX + 1];
+};
+
+/* sum -> preset for one LUT size, sorted by sum */
+struct dump_index {
+    const struct lut_opts *lo;
+    const char *preset_path;
+    uint32_t lut_size;
+    struct drm_color_lut *buf;   /* lut_size entries */
+    struct dump_sum *e;
+    int n, cap;
+    int unknown;                 /* presets in neither cache, left out */
+};
+
+static void dump_index_one(const char *name, void *ctx) {
+    struct dump_index *ix = ctx;
+    struct preset_vals pv;
+    struct dump_sum d = { .order = ix->n };
+    if (load_preset(name, ix->preset_path, &pv) != 1 || !preset_to_params(&pv, &d.params)) return;
+    const struct preset_db_lut *e;
+    const void *data;
+    if (!strcmp(name, "reset")) {
+        /* Built in, so never cached; building it is a copy */
+        build_lut_opts(ix->lo, &d.params, ix->buf, ix->lut_size);
+        d.sum = lut_sum(ix->buf, ix->lut_size);
+    } else if (!ix->lo->cache_dir) {
+        ix->unknown++;
+        return;
+    } else if ((e = preset_db_lut_find(ix->lo, &d.params, ix->lut_size, &data))) {
+        d.sum = e->sum;
+    } else if (!lut_cache_read(ix->lo, &d.params, NULL, ix->lut_size, &d.sum)) {
+        ix->unknown++;
+        return;
+    }
+    if (ix->n == ix->cap) {
+        int cap = ix->cap ? 2 * ix->cap : 16;
+        struct dump_sum *p = realloc(ix->e, sizeof(*p) * (size_t)cap);
+        if (!p) return;
+        ix->e = p;
+        ix->cap = cap;
+    }
+    snprintf(d.name, sizeof(d.name), "%s", name);
+    ix->e[ix->n++] = d;
+}
+
+static int dump_sum_cmp(const void *a, const void *b) {
+    const struct dump_sum *x = a, *y = b;
+    if (x->sum != y->sum) return x->sum < y->sum ? -1 : 1;
+    return x->order - y->order;
+}
+
+static void dump_index_build(struct dump_index *ix, uint32_t lut_size) {
+    ix->n = ix->unknown = 0;
+    ix->lut_size = lut_size;
+    dump_index_one("reset", ix);
+    foreach_preset(ix->preset_path, dump_index_one, ix);
+    if (ix->n) qsort(ix->e, (size_t)ix->n, sizeof(*ix->e), dump_sum_cmp);
+}
+
+/* The first preset (by search order) with sum whose LUT is on ci, NULL if
+ * none. Only those are loaded from their cache and compared in full, with
+ * the color props; *color says whether those matched too. Nothing is built
+ * or written. */
+static const struct dump_sum *dump_match(const struct dump_index *ix, int fd,
+                                         const struct crtc_info *ci, uint64_t sum, bool *color) {
+    int lo_i = 0, hi_i = ix->n;
+    while (lo_i < hi_i) {
+        int mid = lo_i + (hi_i - lo_i) / 2;
+        if (ix->e[mid].sum < sum) lo_i = mid + 1;
+        else hi_i = mid;
+    }
+    const struct dump_sum *found = NULL;
+    *color = false;
+    for (; lo_i < ix->n && ix->e[lo_i].sum == sum && !*color; lo_i++) {
+        const struct dump_sum *d = &ix->e[lo_i];
+        if (!strcmp(d->name, "reset")) build_lut_opts(ix->lo, &d->params, ix->buf, ci->lut_size);
+        else if (!preset_db_lut_load(ix->lo, &d->params, ix->buf, ci->lut_size) &&
+                 !lut_cache_load(ix->lo, &d->params, ix->buf, ci->lut_size)) continue;
+        if (!crtc_shows(fd, ci, ix->buf, NULL)) continue;
+        bool c = crtc_shows(fd, ci, ix->buf, &d->params);
+        if (found && !c) continue;
+        found = d;
+        *color = c;
+    }
+    return found;
+}
+
+/* --dump: read back the GAMMA_LUT of each target (an unset one is the
+ * identity, a legacy CRTC's ramp is asked for) and print what it is, or
+ * write it out for --lut-file. return: exit status */
+static int run_dump(const struct crtc_targets *tg, const char *topo_cache, const char *preset_path,
+                    const struct lut_opts *lo, enum dump_format fmt) {
+    struct topology topo;
+    int fd = open_topology(&topo, topo_cache, board_covers(tg));
+    if (fd < 0) return 1;
+    struct lut_opts o = *lo;
+    if (!o.bits) o.bits = topo.lut_bits;
+
+    struct crtc_info ci[MAX_CRTCS];
+    int n = resolve_targets(&topo, tg, ci);
+    int ret = n > 0 ? 0 : 1;
+    if (!ret && fmt != DUMP_SUMMARY && n > 1) {
+        fprintf(stderr, "--dump-format %s takes a single --crtc or --output.\n", dump_format_names[fmt]);
+        ret = 2;
+    }
+    struct dump_index ix = { .lo = &o, .preset_path = preset_path };
+    for (int k = 0; k < n && !ret; k++) {
+        /* The cached topology does not know the blobs on screen */
+        if (read_crtc_blobs(fd, &ci[k])) { perror("drmModeObjectGetProperties"); ret = 1; break; }
+        size_t len = sizeof(struct drm_color_lut) * ci[k].lut_size;
+        struct drm_color_lut *lut = malloc(len), *buf = malloc(len);
+        if (!lut || !buf) {
+            perror("malloc(lut)");
+            ret = 1;
+        } else if (ci[k].legacy ? legacy_get_lut(fd, &ci[k], lut) != 0
+                                : ci[k].lut_blob && !blob_read(fd, ci[k].lut_blob, lut, len)) {
+            fprintf(stderr, "Cannot read the gamma LUT of CRTC %u\n", ci[k].crtc_id);
+            ret = 1;
+        } else {
+            if (!ci[k].legacy && !ci[k].lut_blob) identity_lut(lut, ci[k].lut_size);
+            if (fmt == DUMP_RAW) {
+                if (!write_all(STDOUT_FILENO, (const char *)lut, len)) { perror("write"); ret = 1; }
+            } else if (fmt == DUMP_CSV) {
+                printf("# crtc=%u size=%u sum=%016llx\n", ci[k].crtc_id, ci[k].lut_size,
+                       (unsigned long long)lut_sum(lut, ci[k].lut_size));
+                for (uint32_t i = 0; i < ci[k].lut_size; i++) {
+                    printf("%u,%u,%u\n", lut[i].red, lut[i].green, lut[i].blue);
+                }
+            } else {
+                ix.buf = buf;
+                if (ix.lut_size != ci[k].lut_size) dump_index_build(&ix, ci[k].lut_size);
+                uint64_t sum = lut_sum(lut, ci[k].lut_size);
+                bool color;
+                const struct dump_sum *d = dump_match(&ix, fd, &ci[k], sum, &color);
+                printf("crtc=%u size=%u sum=%016llx preset=%s%s\n", ci[k].crtc_id, ci[k].lut_size,
+                       (unsigned long long)sum, d ? d->name : ix.unknown ? "unknown" : "none",
+                       d && !color ? " color=differs" : "");
+            }
+        }
+        free(lut);
+        free(buf);
+    }
+    free(ix.e);
     close(fd);
+    return ret;
+}
+
+/* ----------------- Bench ----------------- */
+
+#define BENCH_MAX_ITERS    1000000
+#define BENCH_CPU_LUT_SIZE 1024  /* --cpu-only has no CRTC to ask */
+
+enum {
+    BENCH_PROBE, BENCH_LUT_REF, BENCH_LUT_FAST, BENCH_BLOB, BENCH_COMMIT, BENCH_SWITCH,
+    BENCH_STAGES
+};
+
+static const char *const bench_names[BENCH_STAGES] = {
+    "probe", "lut-ref", "lut-fast", "blob-create", "commit", "switch",
+};
+
+/* Keeps the compiler from dropping LUT builds whose output is never read */
+static volatile uint16_t bench_sink;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted sample, in microseconds */
+static double bench_pct(const uint64_t *ns, uint32_t n, uint32_t pct) {
+    uint64_t rank = ((uint64_t)n * pct + 99) / 100;
+    return (double)ns[rank ? rank - 1 : 0] / 1e3;
+}
+
+static void bench_report(const char *name, uint64_t *ns, uint32_t n) {
+    if (!n) return;
+    qsort(ns, n, sizeof(*ns), cmp_u64);
+    printf("%-12s %8u %10.1f %10.1f %10.1f %10.1f\n", name, n,
+           (double)ns[0] / 1e3, bench_pct(ns, n, 50), bench_pct(ns, n, 99),
+           (double)ns[n - 1] / 1e3);
+}
+
+/* Time each stage of a preset switch separately over iters runs:
+ *   probe       property discovery (probe_crtc)
+ *   lut-ref     build_lut(), double reference
+ *   lut-fast    build_lut_fast()
+ *   blob-create drmModeCreatePropertyBlob
+ *   commit      atomic commit until its vblank event
+ *   switch      end to end: build (selected kernel), blob, commit, vblank
+ * cpu_only skips everything that needs /dev/dri. The cache is never used.
+ * return: exit status */
+static int run_bench(uint32_t iters, bool cpu_only, const struct crtc_targets *tg,
+                     const struct lut_params *p, enum lut_kernel kernel) {
+    uint64_t *ns = calloc((size_t)BENCH_STAGES * iters, sizeof(*ns));
+    uint32_t count[BENCH_STAGES] = { 0 };
+    if (!ns) { perror("calloc(bench)"); return 1; }
+#define BENCH_SAMPLE(stage, t0) (ns[(size_t)(stage) * iters + count[stage]++] = now_ns() - (t0))
+
+    int fd = -1, ret = 0;
+    uint32_t crtc_id = 0;
+    struct crtc_info ci = { .lut_size = BENCH_CPU_LUT_SIZE };
+    if (!cpu_only) {
+        struct topology topo;
+        fd = open_topology(&topo, NULL, false);
+        if (fd < 0) {
+            fprintf(stderr, "No DRM device; use --cpu-only to time the LUT kernels alone.\n");
+            free(ns);
+            return 1;
+        }
+        ret = resolve_targets(&topo, tg, &ci) == 1 ? 0 : -1;
+        crtc_id = ci.crtc_id;
+        for (uint32_t i = 0; i < iters && !ret; i++) {
+            uint64_t t0 = now_ns();
+            ret = probe_crtc(fd, crtc_id, &ci);
+            if (!ret) BENCH_SAMPLE(BENCH_PROBE, t0);
+        }
+    }
+
+    struct drm_color_lut *lut = ret ? NULL : calloc(ci.lut_size, sizeof(*lut));
+    if (!ret && !lut) { perror("calloc(lut)"); ret = -1; }
+    uint64_t heap0 = heap_allocs(), heap = 0;   /* made inside the timed loops */
+    for (uint32_t i = 0; i < iters && !ret; i++) {
+        uint64_t t0 = now_ns();
+        build_lut(p, lut, ci.lut_size);
+        BENCH_SAMPLE(BENCH_LUT_REF, t0);
+        bench_sink = lut[i % ci.lut_size].green;
+    }
+    for (uint32_t i = 0; i < iters && !ret; i++) {
+        uint64_t t0 = now_ns();
+        build_lut_fast(p, lut, ci.lut_size);
+        BENCH_SAMPLE(BENCH_LUT_FAST, t0);
+        bench_sink = lut[i % ci.lut_size].green;
+    }
+    heap += heap_allocs() - heap0;
+
+    if (fd >= 0 && !ret) {
+        size_t len = sizeof(*lut) * ci.lut_size;
+        heap0 = heap_allocs();
+        for (uint32_t i = 0; i < iters && !ret; i++) {
+            uint32_t blob_id = 0;
+            uint64_t t0 = now_ns();
+            ret = drmModeCreatePropertyBlob(fd, lut, len, &blob_id);
+            if (ret) { perror("drmModeCreatePropertyBlob"); break; }
+            BENCH_SAMPLE(BENCH_BLOB, t0);
+            drmModeDestroyPropertyBlob(fd, blob_id);
+        }
+        heap += heap_allocs() - heap0;
+
+        /* Blob IDs do not survive being replaced when nobody else holds a
+         * reference, so keep the current contents to restore from. */
+        struct drm_color_lut *saved = calloc(ci.lut_size, sizeof(*saved));
+        if (!saved) { perror("calloc(lut)"); ret = -1; }
+        else read_current_lut(fd, &ci, saved);
+
+        /* Two blobs with the same contents: alternating between them makes
+         * the kernel reprogram the LUT every time without anything visibly
+         * changing on screen. */
+        uint32_t blobs[2] = { 0, 0 };
+        build_lut_kernel(kernel, p, lut, ci.lut_size);
+        for (int k = 0; k < 2 && !ret; k++) {
+            ret = drmModeCreatePropertyBlob(fd, lut, len, &blobs[k]);
+            if (ret) perror("drmModeCreatePropertyBlob");
+        }
+        heap0 = heap_allocs();
+        for (uint32_t i = 0; i < iters && !ret; i++) {
+            int left = !ci.legacy;
+            uint64_t t0 = now_ns();
+            ret = commit_blob(fd, &ci, blobs[i & 1],
+                              DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, &left);
+            if (!ret) ret = wait_flips(fd, &left);
+            if (!ret) BENCH_SAMPLE(BENCH_COMMIT, t0);
+        }
+        for (uint32_t i = 0; i < iters && !ret; i++) {
+            int left = !ci.legacy;
+            uint64_t t0 = now_ns();
+            build_lut_kernel(kernel, p, lut, ci.lut_size);
+            ret = commit_lut(fd, &ci, lut, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, &left);
+            if (!ret) ret = wait_flips(fd, &left);
+            if (!ret) BENCH_SAMPLE(BENCH_SWITCH, t0);
+        }
+        heap += heap_allocs() - heap0;
+        for (int k = 0; k < 2; k++) {
+            if (blobs[k]) drmModeDestroyPropertyBlob(fd, blobs[k]);
+        }
+
+        /* Put back whatever was on screen before the bench */
+        if (saved && (ci.lut_blob || ci.legacy ? commit_lut(fd, &ci, saved, 0, NULL)
+                                  : commit_blob(fd, &ci, 0, 0, NULL))) {
+            fprintf(stderr, "Failed to restore the original GAMMA_LUT\n");
+        }
+        free(saved);
+    }
+#undef BENCH_SAMPLE
+
+    if (cpu_only) printf("Bench: %u iterations, CPU only, LUT size %u, fast kernel %s\n",
+                         iters, ci.lut_size, LUT_FAST_IMPL);
+    else printf("Bench: %u iterations, CRTC %u, LUT size %u, fast kernel %s\n",
+                iters, crtc_id, ci.lut_size, LUT_FAST_IMPL);
+    printf("%-12s %8s %10s %10s %10s %10s\n", "stage", "n", "min(us)", "p50(us)", "p99(us)", "max(us)");
+    for (int s = 0; s < BENCH_STAGES; s++) {
+        bench_report(bench_names[s], ns + (size_t)s * iters, count[s]);
+    }
+    if (g_heap.counted) printf("heap allocations in the timed loops: %llu\n", (unsigned long long)heap);
+    else printf("heap allocations: not counted (build with make bench)\n");
+    if (ret) fprintf(stderr, "Bench stopped early: %d\n", ret);
+
+    free(lut);
+    free(ns);
+    if (fd >= 0) close(fd);
     return ret ? 1 : 0;
 }
+
+/* ----------------- Daemon ----------------- */
+
+#define MAX_CLIENTS  8
+#define MAX_REQ_ARGS 16
+#define REQ_LINE_MAX 512
+#define MAX_WATCHES  4           /* two preset files, each with its .bin */
+#define UEVENT_BUF   4096
+
+/* After a change uevent the CRTCs are checked at once and again
+ * RESTORE_RECHECK_MS later, in case the modeset lands after the event. */
+#define RESTORE_RECHECK_MS 1000
+#define STATE_SAVE_MS      5000  /* --state is rewritten at most this often */
+#define LEGACY_FRAME_MS    16    /* fade frame interval on legacy CRTCs (no flip events) */
+
+/* --shm: the ring is read SHM_LATCH_US before the vblank predicted from the
+ * last vblank event, so its latest entry makes the next frame. */
+#define SHM_LATCH_US       2000
+#define SHM_PERIOD_NS      16666667ull   /* frame period until one is measured */
+
+/* Adaptive mode: at most one update (and one sensor read) per
+ * ADAPT_INTERVAL_MS, each faded in over the interval; blends are quantized so their LUT blobs
+ * are reused, and the light level must move by the hysteresis first. */
+#define ADAPT_STEPS      32      /* blend positions between the two presets */
+#define ADAPT_HYSTERESIS 0.05    /* of the light range */
+#define ADAPT_SMOOTHING  0.3     /* weight of a new sample in the level */
+
+/* --adaptive <dark>,<bright> [--light <src>] [--light-range <lo>,<hi>] */
+struct adapt_opts {
+    const char *dark, *bright;   /* presets at the low and high end of the range */
+    const char *source;          /* sensor file, FIFO or "-"; NULL = socket only */
+    double lo, hi;               /* light values mapped to dark and bright */
+};
+
+struct crtc_state {
+    struct crtc_info info;
+    struct drm_color_lut *cur;   /* LUT on screen (last commit) */
+    struct drm_color_lut *from;  /* fade start */
+    struct drm_color_lut *to;    /* requested LUT / fade target */
+    uint64_t fade_t0;
+    uint32_t fade_ms;
+    bool fading;
+    bool in_flight;              /* waiting for the flip event */
+    bool pending;                /* async: cs->to still has to be committed */
+    bool to_cached;              /* cs->to is the cached LUT for to_params */
+    bool color_dirty;            /* to_params' DEGAMMA_LUT/CTM not committed yet */
+    struct lut_params to_params;
+    char preset[INI_NAME_MAX + 1];  /* preset shown, "" for plain values */
+    uint64_t submitted;          /* commits handed to the kernel */
+    uint64_t landed;             /* commits known to be on screen */
+    uint64_t submit_ns;          /* when the commit in flight was made */
+    bool applied;                /* to_params has been committed (restore it) */
+    bool in_state;               /* saved is what the --state file holds */
+    struct lut_params saved;
+};
+
+struct daemon {
+    int fd;                     /* DRM card, opened once */
+    const char *preset_path;
+    struct crtc_targets targets; /* for requests without --crtc */
+    uint32_t default_fade_ms;
+    bool async;                 /* DRM_MODE_ATOMIC_NONBLOCK commits */
+    int ncrtc;
+    struct crtc_state crtc[MAX_CRTCS];
+    struct topology topo;       /* scanned at startup and on SIGHUP */
+    struct lut_mem_cache luts;
+    struct lut_warm warm;       /* background builds for luts */
+    int ifd;                    /* inotify on the preset directories */
+    int nwatch;
+    struct preset_watch {
+        int wd;
+        char name[NAME_MAX + 1]; /* entry in the watched directory */
+        const char *path;        /* the preset file (ini_open() key) it affects */
+    } watch[MAX_WATCHES];
+    struct adapt {
+        struct adapt_opts o;
+        bool on;                 /* --adaptive given */
+        bool paused;             /* a plain request took over, until --auto */
+        int fd;                  /* light source, -1 if none */
+        bool sampled;            /* fd is a sensor file, re-read every interval */
+        char buf[64];            /* partial line from a stream source */
+        size_t len;
+        double level;            /* smoothed light value */
+        bool have_level;
+        bool fresh;              /* samples since the last update */
+        int step;                /* blend on screen (0..ADAPT_STEPS), -1 = none */
+        uint64_t next_ns;        /* next interval tick */
+    } adapt;
+    int ufd;                    /* kernel uevents, -1 if unavailable */
+    uint64_t restore_ns;        /* second restore check, 0 = none */
+    const char *state_path;     /* --state, NULL = none */
+    uint64_t state_ns;          /* --state save due, 0 = none */
+    struct shm_ring {
+        struct gamma_shm *map;   /* NULL = no --shm */
+        uint64_t seen;           /* head as of the last pick-up */
+        uint32_t crtc_id;        /* CRTC whose vblanks pace the pick-ups */
+        bool armed;              /* vblank event requested */
+        unsigned int seq;        /* frame counter of the last vblank event */
+        uint64_t vblank_ns;      /* its timestamp (CLOCK_MONOTONIC) */
+        uint64_t period_ns;      /* measured frame period */
+        uint64_t check_ns;       /* next pick-up, 0 = waiting for the event */
+    } shm;
+};
+
+struct client {
+    int fd;
+    bool eof;
+    size_t len;
+    char buf[REQ_LINE_MAX];
+    /* --wait: reply deferred until every wait_cs[k]->landed reaches wait_ticket[k] */
+    int nwait;
+    struct crtc_state *wait_cs[MAX_CRTCS];
+    uint64_t wait_ticket[MAX_CRTCS];
+    uint64_t wait_t0;
+};
+
+static volatile sig_atomic_t g_stop;
+static volatile sig_atomic_t g_reload;
+
+static void on_signal(int sig) {
+    if (sig == SIGHUP) g_reload = 1;
+    else g_stop = 1;
+}
+
+static int connect_socket(const char *path) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    strcpy(sa.sun_path, path);
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        int e = errno;
+        close(s);
+        errno = e;
+        return -1;
+    }
+    return s;
+}
+
+static int listen_socket(const char *path) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+
+    /* Refuse to steal the socket from a daemon that is still alive */
+    int probe = connect_socket(path);
+    if (probe >= 0) {
+        close(probe);
+        fprintf(stderr, "A gamma daemon is already listening on %s\n", path);
+        return -1;
+    }
+    unlink(path);
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) { perror("socket"); return -1; }
+    if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(s, MAX_CLIENTS) < 0) {
+        fprintf(stderr, "bind %s: %s\n", path, strerror(errno));
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+struct preload_ctx {
+    struct daemon *d;
+    uint32_t lut_size;
+    int count, queued;
+};
+
+static void preload_one(const char *name, void *ctx) {
+    struct preload_ctx *pc = ctx;
+    struct preset_vals pv;
+    struct lut_params p;
+    if (load_preset(name, pc->d->preset_path, &pv) != 1 || !preset_to_params(&pv, &p)) return;
+
+    /* Left to the warm-up unless it is in memory or a compiled database */
+    struct lut_mem_cache *mc = &pc->d->luts;
+    const void *data;
+    if (!lut_mem_find(mc, &p, pc->lut_size) &&
+        !(mc->opts.cache_dir && preset_db_lut_find(&mc->opts, &p, pc->lut_size, &data))) {
+        int st = warm_add(&pc->d->warm, &p, pc->lut_size);
+        pc->queued += st > 0;
+        if (st >= 0) return;
+    }
+
+    struct lut_mem_entry *e = lut_mem_get(mc, &p, pc->lut_size);
+    if (!e) return;
+    e->pinned = true;
+    if (lut_mem_blob(&pc->d->luts, e)) pc->count++;
+}
+
+/* Create (and pin) the LUT and blob of every preset for one LUT size, so
+ * switching to any of them never creates a blob. LUTs that have to be
+ * built are queued for the warm-up and picked up by daemon_warm(). */
+static void daemon_preload(struct daemon *d, uint32_t lut_size) {
+    struct preload_ctx pc = { .d = d, .lut_size = lut_size };
+    warm_stop(&d->warm);
+    preload_one("reset", &pc);
+    foreach_preset(d->preset_path, preload_one, &pc);
+    if (pc.queued) {
+        fprintf(stderr, "gamma: %d preset blobs ready for LUT size %u, %d more warming up\n",
+                pc.count, lut_size, pc.queued);
+    } else {
+        fprintf(stderr, "gamma: %d preset blobs ready for LUT size %u\n", pc.count, lut_size);
+    }
+}
+
+/* warm.efd: move the LUTs the workers finished into the in-memory cache,
+ * pinned and with their blob, and report once the warm-up is through. */
+static void daemon_warm(struct daemon *d) {
+    struct lut_warm *w = &d->warm;
+    uint64_t cnt;
+    if (w->efd >= 0 && read(w->efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+
+    bool busy = false;
+    for (int i = 0; i < w->n; i++) {
+        struct warm_job *j = &w->job[i];
+        int st = __atomic_load_n(&j->state, __ATOMIC_ACQUIRE);
+        if (st == WARM_QUEUED || st == WARM_BUILDING) busy = true;
+        if (st != WARM_DONE) continue;
+        /* A miss takes the job's LUT (see lut_mem_fill()) */
+        struct lut_mem_entry *e = lut_mem_get(&d->luts, &j->params, j->lut_size);
+        if (e) {
+            e->pinned = true;
+            lut_mem_blob(&d->luts, e);
+        }
+        if (j->state == WARM_DONE) {
+            j->state = WARM_TAKEN;
+            free(j->lut);
+            j->lut = NULL;
+        }
+    }
+    if (busy || !w->t0) return;
+
+    int threads = w->nthreads;
+    warm_stop(w);
+    fprintf(stderr, "gamma: warm-up done: %d LUTs ready in %llu ms on %d thread%s\n",
+            w->n, (unsigned long long)((now_ns() - w->t0) / 1000000),
+            threads ? threads : 1, threads == 1 ? "" : "s");
+    warm_reset(w);
+}
+
+static struct crtc_state *daemon_crtc(struct daemon *d, uint32_t crtc_id) {
+    for (int i = 0; i < d->ncrtc; i++) {
+        if (d->crtc[i].info.crtc_id == crtc_id) return &d->crtc[i];
+    }
+    if (d->ncrtc == MAX_CRTCS) {
+        fprintf(stderr, "Too many CRTCs in use (max %d)\n", MAX_CRTCS);
+        return NULL;
+    }
+
+    struct crtc_state *cs = &d->crtc[d->ncrtc];
+    memset(cs, 0, sizeof(*cs));
+    if (probe_crtc(d->fd, crtc_id, &cs->info)) return NULL;
+
+    uint32_t n = cs->info.lut_size;
+    cs->cur = calloc(3 * (size_t)n, sizeof(*cs->cur));
+    if (!cs->cur) { perror("calloc(lut)"); return NULL; }
+    cs->from = cs->cur + n;
+    cs->to = cs->cur + 2 * n;
+    cs->color_dirty = true;      /* the first commit sets DEGAMMA_LUT/CTM too */
+    read_current_lut(d->fd, &cs->info, cs->cur);
+
+    d->ncrtc++;
+    bool new_size = true;
+    for (int i = 0; i < d->ncrtc - 1; i++) {
+        if (d->crtc[i].info.lut_size == n) new_size = false;
+    }
+    if (new_size) daemon_preload(d, n);
+    return cs;
+}
+
+/* The CRTC states a request applies to. return: count, -1 on error */
+static int daemon_targets(struct daemon *d, const struct crtc_targets *t, struct crtc_state **cs) {
+    struct crtc_info ci[MAX_CRTCS];
+    /* The board profile has DEFAULT_CRTC only; anything else needs the scan */
+    struct topology topo;
+    if (d->topo.board && !board_covers(t) && scan_topology(d->fd, d->topo.card, &topo) == 0) d->topo = topo;
+    int n = resolve_targets(&d->topo, t, ci);
+    for (int k = 0; k < n; k++) {
+        cs[k] = daemon_crtc(d, ci[k].crtc_id);
+        if (!cs[k]) return -1;
+    }
+    return n;
+}
+
+/* Hand one LUT per CRTC to the kernel, all in one commit. With event=true
+ * (fades) or in async mode the commit asks for flip events and each CRTC's
+ * in_flight is set until its event arrives. DRM master is held for the
+ * commit only (see commit_gamma_master()). */
+static int daemon_submit(struct daemon *d, struct crtc_state *const *cs,
+                         const struct drm_color_lut *const *luts, const uint32_t *blob_ids,
+                         const struct lut_params *const *color, int n, bool event) {
+    uint32_t flags = event ? DRM_MODE_PAGE_FLIP_EVENT : 0;
+    if (d->async) flags |= DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+
+    const struct crtc_info *ci[MAX_CRTCS];
+    for (int k = 0; k < n; k++) ci[k] = &cs[k]->info;
+    int ret = commit_gamma_master(d->fd, ci, luts, blob_ids, color, n, flags, d);
+    if (ret) return ret;
+
+    for (int k = 0; k < n; k++) {
+        if (color[k]) cs[k]->color_dirty = false;
+        cs[k]->submitted++;
+        cs[k]->submit_ns = now_ns();
+        if ((flags & DRM_MODE_PAGE_FLIP_EVENT) && !cs[k]->info.legacy) cs[k]->in_flight = true;
+        else cs[k]->landed = cs[k]->submitted;
+    }
+    return 0;
+}
+
+/* The persistent blob for cs->to, or 0 to fall back to a one-off blob. The
+ * entry is looked up again (by params) because it may have been evicted. */
+static uint32_t daemon_target_blob(struct daemon *d, struct crtc_state *cs) {
+    if (!cs->to_cached) return 0;
+    struct lut_mem_entry *e = lut_mem_get(&d->luts, &cs->to_params, cs->info.lut_size);
+    return e ? lut_mem_blob(&d->luts, e) : 0;
+}
+
+/* Start the next commit: every idle CRTC with work queued (its next fade
+ * frame, or cs->to when pending) goes into one atomic request, so CRTCs
+ * named by the same request switch on the same frame. A CRTC that is still
+ * in flight keeps its work until its flip event; a newer request simply
+ * overwrites cs->to, so only the latest LUT is committed.
+ * return: 0, or 1 if the commit failed */
+static int daemon_kick(struct daemon *d) {
+    struct crtc_state *batch[MAX_CRTCS];
+    const struct drm_color_lut *luts[MAX_CRTCS];
+    const struct lut_params *color[MAX_CRTCS];
+    uint32_t blobs[MAX_CRTCS];
+    bool event = false;
+    int n = 0;
+
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        if (cs->in_flight || !(cs->fading || cs->pending)) continue;
+        double t = cs->fading ? fade_progress(cs->fade_t0, cs->fade_ms) : 1.0;
+        if (t < 1.0) {
+            lerp_lut(cs->from, cs->to, cs->cur, cs->info.lut_size, t);
+            luts[n] = cs->cur;
+            blobs[n] = 0;
+        } else {
+            luts[n] = cs->to;
+            blobs[n] = daemon_target_blob(d, cs);
+        }
+        color[n] = cs->color_dirty ? &cs->to_params : NULL;
+        event |= cs->fading;
+        batch[n++] = cs;
+    }
+    if (!n) return 0;
+
+    int ret = daemon_submit(d, batch, luts, blobs, color, n, event);
+    if (ret == -EBUSY && d->async) {
+        /* Someone else's commit is still in flight; retried from the poll loop */
+        return 0;
+    }
+    if (ret && event) {
+        /* No vblank events (inactive CRTC?): land fades on their target directly */
+        for (int k = 0; k < n; k++) {
+            if (!batch[k]->fading) continue;
+            fprintf(stderr, "CRTC %u: fade aborted, applying target LUT directly.\n",
+                    batch[k]->info.crtc_id);
+            batch[k]->fading = false;
+            batch[k]->pending = true;
+        }
+        bool async = d->async;
+        d->async = false;
+        ret = daemon_kick(d);
+        d->async = async;
+        return ret;
+    }
+
+    for (int k = 0; k < n; k++) {
+        struct crtc_state *cs = batch[k];
+        if (luts[k] != cs->to) continue;
+        if (!ret) {
+            memcpy(cs->cur, cs->to, cs->info.lut_size * sizeof(*cs->cur));
+            cs->applied = true;
+            if (d->state_path && !d->state_ns) {
+                d->state_ns = now_ns() + (uint64_t)STATE_SAVE_MS * 1000000;
+            }
+        }
+        cs->fading = false;
+        cs->pending = false;
+    }
+    return ret ? 1 : 0;
+}
+
+static void daemon_flip_event(int fd, unsigned int seq, unsigned int sec, unsigned int usec,
+                              unsigned int crtc_id, void *data) {
+    struct daemon *d = data;
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        if (cs->info.crtc_id != crtc_id) continue;
+        if (cs->in_flight) stats_observe(&g_stats.flip, now_ns() - cs->submit_ns);
+        cs->in_flight = false;
+        cs->landed = cs->submitted;
+    }
+}
+
+/* --shm pacing: schedule the next pick-up SHM_LATCH_US ahead of the vblank
+ * after this one; the period is measured over the frames since the last event. */
+static void daemon_vblank_event(int fd, unsigned int seq, unsigned int sec, unsigned int usec,
+                                void *data) {
+    struct daemon *d = data;
+    struct shm_ring *r = &d->shm;
+    uint64_t t = (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000;
+    if (r->vblank_ns && t > r->vblank_ns && seq > r->seq) {
+        r->period_ns = (t - r->vblank_ns) / (seq - r->seq);
+    }
+    r->seq = seq;
+    r->vblank_ns = t;
+    r->armed = false;
+    uint64_t latch = (uint64_t)SHM_LATCH_US * 1000;
+    r->check_ns = t + (r->period_ns > latch ? r->period_ns - latch : 0);
+}
+
+static void daemon_drm_events(struct daemon *d) {
+    drmEventContext ev = {
+        .version = 3,
+        .vblank_handler = daemon_vblank_event,
+        .page_flip_handler2 = daemon_flip_event,
+    };
+    if (drmHandleEvent(d->fd, &ev)) perror("drmHandleEvent");
+    daemon_kick(d);
+}
+
+static bool daemon_retry_pending(const struct daemon *d) {
+    for (int i = 0; i < d->ncrtc; i++) {
+        const struct crtc_state *cs = &d->crtc[i];
+        if ((cs->pending || (cs->fading && !cs->info.legacy)) && !cs->in_flight) return true;
+    }
+    return false;
+}
+
+/* LUT p from the in-memory cache into lut. return: whether it was cached */
+static bool daemon_lut(struct daemon *d, const struct lut_params *p, struct drm_color_lut *lut,
+                       uint32_t lut_size) {
+    struct lut_mem_entry *e = lut_mem_get(&d->luts, p, lut_size);
+    if (e) memcpy(lut, e->lut, sizeof(*lut) * lut_size);
+    else build_lut_opts(&d->luts.opts, p, lut, lut_size);
+    return e != NULL;
+}
+
+/* cs->to is filled in: take p's DEGAMMA_LUT/CTM with it, faded in over
+ * fade_ms from what is on screen (0 = cut), and queue it for daemon_kick().
+ * cached: cs->to is p's cache entry, whose blob can be reused. */
+static void daemon_retarget(struct daemon *d, struct crtc_state *cs, const struct lut_params *p,
+                            bool cached, uint32_t fade_ms, uint64_t t0) {
+    if (!color_equal(p, &cs->to_params)) cs->color_dirty = true;
+    cs->to_params = *p;
+    cs->to_cached = cached;
+
+    if (fade_ms) {
+        /* (Re)start from whatever is on screen; a fade in progress is retargeted */
+        memcpy(cs->from, cs->cur, cs->info.lut_size * sizeof(*cs->cur));
+        cs->fade_t0 = t0 - FADE_FRAME_NS;   /* see fade_progress() */
+        cs->fade_ms = fade_ms;
+        cs->fading = true;
+        cs->pending = false;
+    } else {
+        cs->fading = false;
+        cs->pending = true;
+    }
+}
+
+/* Point cs at LUT p, faded in over fade_ms from what is on screen (0 = cut),
+ * and queue it for daemon_kick(). */
+static void daemon_set_target(struct daemon *d, struct crtc_state *cs, const struct lut_params *p,
+                              uint32_t fade_ms, uint64_t t0) {
+    if (cs->pending || cs->fading) g_stats.coalesced++;
+    bool cached = daemon_lut(d, p, cs->to, cs->info.lut_size);
+    daemon_retarget(d, cs, p, cached, fade_ms, t0);
+}
+
+/* Point cs at the mix of two LUTs. Presets are preloaded, so both are
+ * copies out of the cache and the mix is a blend_lut(), not a LUT build. */
+static void daemon_set_blend(struct daemon *d, struct crtc_state *cs, const struct lut_blend *bl,
+                             uint32_t fade_ms, uint64_t t0) {
+    if (cs->pending || cs->fading) g_stats.coalesced++;
+    uint32_t n = cs->info.lut_size;
+    struct drm_color_lut *b = scratch(SCRATCH_BLEND, sizeof(*b) * n);
+    daemon_lut(d, &bl->a, cs->to, n);
+    if (b) {
+        daemon_lut(d, &bl->b, b, n);
+        blend_lut(cs->to, b, cs->to, n, bl->t, d->luts.opts.bits, d->luts.opts.dither);
+    } else {
+        perror("realloc(lut)");
+    }
+    daemon_retarget(d, cs, blend_color(bl), false, fade_ms, t0);
+}
+
+/* The presets were re-read: blobs of presets whose values changed are
+ * created anew, unchanged ones are kept, stale ones become evictable, and
+ * CRTCs showing a changed preset switch to its new values. */
+static void daemon_presets_changed(struct daemon *d) {
+    warm_reset(&d->warm);
+    for (int i = 0; i < d->luts.n; i++) d->luts.e[i].pinned = false;
+    for (int i = 0; i < d->ncrtc; i++) {
+        bool seen = false;
+        for (int j = 0; j < i; j++) {
+            if (d->crtc[j].info.lut_size == d->crtc[i].info.lut_size) seen = true;
+        }
+        if (!seen) daemon_preload(d, d->crtc[i].info.lut_size);
+    }
+    lut_mem_evict(&d->luts);
+
+    bool kick = false;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        struct preset_vals pv;
+        struct lut_params p;
+        if (!cs->preset[0]) continue;
+        if (load_preset(cs->preset, d->preset_path, &pv) != 1 || !preset_to_params(&pv, &p)) {
+            fprintf(stderr, "gamma: preset '%s' (CRTC %u) no longer loads; keeping it on screen.\n",
+                    cs->preset, cs->info.crtc_id);
+            continue;
+        }
+        if (!memcmp(&p, &cs->to_params, sizeof(p))) continue;
+        fprintf(stderr, "gamma: re-applying preset '%s' on CRTC %u\n", cs->preset, cs->info.crtc_id);
+        daemon_set_target(d, cs, &p, d->default_fade_ms, t0);
+        kick = true;
+    }
+    if (kick) daemon_kick(d);
+
+    /* The two adaptive presets may have changed too */
+    d->adapt.step = -1;
+    d->adapt.fresh = d->adapt.have_level;
+}
+
+/* SIGHUP: rescan outputs and re-read every preset file. */
+static void daemon_reload(struct daemon *d) {
+    ini_reset();
+    struct topology topo;
+    if (scan_topology(d->fd, d->topo.card, &topo) == 0) d->topo = topo;
+    daemon_presets_changed(d);
+}
+
+/* Watch the directory holding file (editors often replace files by rename,
+ * which a watch on the file itself would not survive). */
+static void daemon_watch_file(struct daemon *d, const char *file, const char *path) {
+    const char *slash = strrchr(file, '/');
+    char dir[PATH_MAX];
+    const char *base = slash ? slash + 1 : file;
+    if (!slash) strcpy(dir, ".");
+    else if ((size_t)snprintf(dir, sizeof(dir), "%.*s", slash == file ? 1 : (int)(slash - file), file) >= sizeof(dir)) return;
+    if (d->nwatch == MAX_WATCHES || strlen(base) > NAME_MAX) return;
+
+    int wd = inotify_add_watch(d->ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                            IN_DELETE | IN_MODIFY);
+    if (wd < 0) {
+        if (errno != ENOENT) fprintf(stderr, "inotify %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    struct preset_watch *w = &d->watch[d->nwatch++];
+    w->wd = wd;
+    strcpy(w->name, base);
+    w->path = path;
+}
+
+static void daemon_watch_presets(struct daemon *d) {
+    static const char *const defaults[] = { "./presets.ini", "/etc/gamma-presets.ini" };
+    d->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (d->ifd < 0) {
+        perror("inotify_init1 (presets will only be re-read on SIGHUP)");
+        return;
+    }
+    for (int i = 0; i < (d->preset_path ? 1 : 2); i++) {
+        const char *path = d->preset_path ? d->preset_path : defaults[i];
+        char bin[PATH_MAX];
+        daemon_watch_file(d, path, path);
+        if (db_sibling(path, bin, sizeof(bin))) daemon_watch_file(d, bin, path);
+    }
+}
+
+/* Drop the index of every preset file that changed and, once a write is
+ * complete (close, rename, delete), re-read them. A write in progress
+ * (IN_MODIFY) only drops the index, so a truncated file is never used. */
+static void daemon_inotify(struct daemon *d) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+    while ((n = read(d->ifd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+        for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const void *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                ini_reset();
+                changed = true;
+            }
+            for (int i = 0; i < d->nwatch; i++) {
+                const struct preset_watch *w = &d->watch[i];
+                if (w->wd != ev->wd || !ev->len || strcmp(ev->name, w->name)) continue;
+                ini_drop(w->path);
+                if (ev->mask & ~IN_MODIFY) changed = true;
+            }
+        }
+    }
+    if (changed) daemon_presets_changed(d);
+}
+
+static void adapt_sample(struct daemon *d, double x) {
+    struct adapt *a = &d->adapt;
+    a->level = a->have_level ? a->level + (x - a->level) * ADAPT_SMOOTHING : x;
+    a->have_level = true;
+    a->fresh = true;
+}
+
+/* One line of light input ("123", "0.42\n"); junk is reported and ignored. */
+static void adapt_line(struct daemon *d, char *s) {
+    size_t n = strlen(s);
+    while (n && strchr(" \t\r\n", s[n - 1])) s[--n] = '\0';
+    if (!n) return;
+    double x;
+    if (parse_double_strict(s, &x)) adapt_sample(d, x);
+    else fprintf(stderr, "gamma: ignoring light sample '%s'\n", s);
+}
+
+/* Take what the light source has: the current value of a sensor file, or
+ * every complete line from a stream (a FIFO or stdin). */
+static void adapt_read(struct daemon *d) {
+    struct adapt *a = &d->adapt;
+    if (a->sampled) {
+        /* sysfs attributes are regenerated on every read from offset 0 */
+        ssize_t n = pread(a->fd, a->buf, sizeof(a->buf) - 1, 0);
+        if (n < 0) { perror("gamma: light sensor"); return; }
+        a->buf[n] = '\0';
+        adapt_line(d, a->buf);
+        return;
+    }
+
+    ssize_t n = read(a->fd, a->buf + a->len, sizeof(a->buf) - 1 - a->len);
+    if (n < 0) {
+        if (errno != EINTR && errno != EAGAIN) perror("gamma: light source");
+        return;
+    }
+    if (n == 0) {
+        fprintf(stderr, "gamma: light source closed; keeping the last level.\n");
+        if (a->fd > 0) close(a->fd);
+        a->fd = -1;
+        return;
+    }
+    a->len += (size_t)n;
+    a->buf[a->len] = '\0';
+    char *line = a->buf, *nl;
+    while ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        adapt_line(d, line);
+        line = nl + 1;
+    }
+    a->len -= (size_t)(line - a->buf);
+    memmove(a->buf, line, a->len + 1);
+    /* A line that fills the buffer is junk; drop it */
+    if (a->len == sizeof(a->buf) - 1) a->len = 0;
+}
+
+/* poll() timeout until the next interval tick that has work, -1 if none */
+static int adapt_timeout(const struct daemon *d, uint64_t now) {
+    const struct adapt *a = &d->adapt;
+    if (!a->on || a->paused || !(a->sampled || a->fresh)) return -1;
+    if (a->next_ns <= now) return 0;
+    return (int)((a->next_ns - now + 999999) / 1000000);
+}
+
+/* Interval tick: read the sensor and, once the smoothed level has moved past
+ * the hysteresis, fade the default CRTCs to the matching blend.
+ * return: exit-style status of the kick (0 if there was nothing to do) */
+static int adapt_tick(struct daemon *d, uint64_t now) {
+    struct adapt *a = &d->adapt;
+    if (!a->on || a->paused || now < a->next_ns) return 0;
+    a->next_ns = now + (uint64_t)ADAPT_INTERVAL_MS * 1000000;
+    if (a->sampled) adapt_read(d);
+    if (!a->fresh) return 0;
+    a->fresh = false;
+
+    double t = (a->level - a->o.lo) / (a->o.hi - a->o.lo);
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    int step = (int)lround(t * ADAPT_STEPS);
+    if (a->step >= 0 && (step == a->step || fabs(t - (double)a->step / ADAPT_STEPS) < ADAPT_HYSTERESIS)) {
+        return 0;
+    }
+
+    struct preset_vals pv;
+    struct lut_params pd, pb, p;
+    if (load_preset(a->o.dark, d->preset_path, &pv) != 1 || !preset_to_params(&pv, &pd) ||
+        load_preset(a->o.bright, d->preset_path, &pv) != 1 || !preset_to_params(&pv, &pb)) {
+        fprintf(stderr, "gamma: adaptive presets '%s'/'%s' do not load; holding.\n",
+                a->o.dark, a->o.bright);
+        return 0;
+    }
+    blend_params(&pd, &pb, (double)step / ADAPT_STEPS, &p);
+
+    struct crtc_state *css[MAX_CRTCS];
+    int n = daemon_targets(d, &d->targets, css);
+    if (n < 0) return 1;
+    for (int k = 0; k < n; k++) {
+        daemon_set_target(d, css[k], &p, ADAPT_INTERVAL_MS, now);
+        css[k]->preset[0] = '\0';
+    }
+    a->step = step;
+    return daemon_kick(d);
+}
+
+/* Open --light: "-" is stdin, a FIFO is read line by line as it is written,
+ * anything else (an IIO in_illuminance_* file) is sampled every interval. */
+static int adapt_open(struct adapt *a) {
+    a->fd = -1;
+    if (!a->o.source) return 0;
+    if (!strcmp(a->o.source, "-")) {
+        a->fd = 0;
+        return 0;
+    }
+    struct stat st;
+    if (stat(a->o.source, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", a->o.source, strerror(errno));
+        return -1;
+    }
+    /* O_RDWR keeps the FIFO open, and quiet, between writers */
+    a->sampled = !S_ISFIFO(st.st_mode);
+    a->fd = open(a->o.source, (a->sampled ? O_RDONLY : O_RDWR | O_NONBLOCK) | O_CLOEXEC);
+    if (a->fd < 0) {
+        fprintf(stderr, "open %s: %s\n", a->o.source, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Netlink socket on the kernel's uevent broadcast.
+ * return: fd, -1 if unavailable (reported; restoring is then off) */
+static int uevent_open(void) {
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+    int s = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (s < 0 || bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "Warning: no uevents (%s); LUTs are not restored after a modeset.\n",
+                strerror(errno));
+        if (s >= 0) close(s);
+        return -1;
+    }
+    return s;
+}
+
+/* Whether a uevent ("change@<devpath>\0KEY=VAL\0...", NUL-terminated at len)
+ * is a change of the DRM device devname ("dri/cardN"). */
+static bool uevent_is_card(const char *msg, size_t len, const char *devname) {
+    bool change = false, drm = false, card = false;
+    for (size_t at = 0; at < len; at += strlen(msg + at) + 1) {
+        const char *kv = msg + at;
+        if (!strcmp(kv, "ACTION=change")) change = true;
+        else if (!strcmp(kv, "SUBSYSTEM=drm")) drm = true;
+        else if (!strncmp(kv, "DEVNAME=", 8) && !strcmp(kv + 8, devname)) card = true;
+    }
+    return change && drm && card;
+}
+
+/* Commit the LUT again on every idle CRTC the daemon has set that no longer
+ * shows it (a modeset or hotplug reset it). cs->to and its blob are reused
+ * as they are: no preset lookup, no LUT build. */
+static void daemon_restore(struct daemon *d) {
+    bool kick = false;
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        if (!cs->applied || cs->in_flight || cs->pending || cs->fading) continue;
+        if (read_crtc_blobs(d->fd, &cs->info)) continue;
+        if (crtc_shows(d->fd, &cs->info, cs->to, &cs->to_params)) continue;
+        fprintf(stderr, "gamma: CRTC %u lost its LUT; restoring it\n", cs->info.crtc_id);
+        cs->pending = true;
+        cs->color_dirty = true;
+        kick = true;
+    }
+    if (kick) daemon_kick(d);
+}
+
+/* uevent socket readable: on a change of our card, rescan the outputs and
+ * restore the LUTs, now and once more after RESTORE_RECHECK_MS. */
+static void daemon_uevent(struct daemon *d) {
+    const char *devname = d->topo.card;
+    if (!strncmp(devname, "/dev/", 5)) devname += 5;
+
+    char buf[UEVENT_BUF + 1];
+    bool hit = false;
+    for (;;) {
+        struct sockaddr_nl sa;
+        socklen_t sl = sizeof(sa);
+        ssize_t len = recvfrom(d->ufd, buf, UEVENT_BUF, 0, (struct sockaddr *)&sa, &sl);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            /* Events were dropped; one of them may have been ours */
+            if (errno == ENOBUFS) { hit = true; continue; }
+            break;
+        }
+        buf[len] = '\0';
+        /* Only the kernel (port 0) speaks for the device */
+        if (sa.nl_pid == 0 && uevent_is_card(buf, (size_t)len, devname)) hit = true;
+    }
+    if (!hit) return;
+
+    struct topology topo;
+    if (scan_topology(d->fd, d->topo.card, &topo) == 0) d->topo = topo;
+    daemon_restore(d);
+    d->restore_ns = now_ns() + (uint64_t)RESTORE_RECHECK_MS * 1000000;
+}
+
+/* --state: write every LUT the daemon has set as a --boot snapshot, unless
+ * the file already holds exactly these. */
+static void daemon_save_state(struct daemon *d) {
+    d->state_ns = 0;
+    bool changed = false;
+    for (int i = 0; i < d->ncrtc; i++) {
+        const struct crtc_state *cs = &d->crtc[i];
+        if (cs->applied && (!cs->in_state || memcmp(&cs->saved, &cs->to_params, sizeof(cs->saved)))) {
+            changed = true;
+        }
+    }
+    if (!changed) return;
+
+    char *buf = calloc(1, BOOT_FILE_MAX);
+    struct drm_color_lut *scratch = calloc(LUT_FILE_MAX, sizeof(*scratch));
+    struct boot_hdr h = { .magic = { 'G', 'B', 'O', 'T' }, .version = BOOT_VERSION };
+    size_t at = sizeof(h);
+    if (!buf || !scratch) { perror("calloc"); goto out; }
+    snprintf(h.card, sizeof(h.card), "%s", d->topo.card);
+
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        if (!cs->applied) continue;
+        if (boot_add_crtc(buf, &at, &h, &cs->info, cs->to, &cs->to_params, scratch)) goto out;
+    }
+    if (boot_write(d->state_path, buf, at, &h)) goto out;
+    for (int i = 0; i < d->ncrtc; i++) {
+        struct crtc_state *cs = &d->crtc[i];
+        if (!cs->applied) continue;
+        cs->saved = cs->to_params;
+        cs->in_state = true;
+    }
+out:
+    free(scratch);
+    free(buf);
+}
+
+/* Show p, or the mix blend when that is set, on the CRTCs of targets
+ * (crtc_id, the preset's crtc= if it has one, replaces a single default
+ * target), as a request from c does; c is NULL for --shm entries, which get
+ * no reply. return: exit-style status */
+static int daemon_apply(struct daemon *d, struct client *c, const struct crtc_targets *targets,
+                        const struct lut_params *p, const struct lut_blend *blend,
+                        const char *preset, uint32_t crtc_id,
+                        uint32_t fade_ms, bool force, bool wait) {
+    struct crtc_targets tg = *targets;
+    if (crtc_targets_single(&tg) && crtc_id != tg.ids[0]) {
+        tg.ids[0] = crtc_id;
+        tg.is_default = false;
+    }
+
+    struct crtc_state *css[MAX_CRTCS];
+    int n = daemon_targets(d, &tg, css);
+    if (n < 0) return 1;
+    d->adapt.paused = d->adapt.on;
+
+    uint64_t t0 = now_ns();
+    char same[MAX_CRTCS * 11];
+    size_t len = 0;
+    int nsame = 0;
+    bool skip[MAX_CRTCS] = { false };
+    for (int k = 0; k < n; k++) {
+        struct crtc_state *cs = css[k];
+        bool busy = cs->fading || cs->pending || cs->in_flight;
+        if (blend) daemon_set_blend(d, cs, blend, fade_ms, t0);
+        else daemon_set_target(d, cs, p, fade_ms, t0);
+        snprintf(cs->preset, sizeof(cs->preset), "%s", preset);
+        if (force || busy || cs->color_dirty ||
+            memcmp(cs->to, cs->cur, sizeof(*cs->cur) * cs->info.lut_size)) continue;
+        cs->fading = false;
+        cs->pending = false;
+        skip[k] = true;
+        g_stats.skipped++;
+        len += (size_t)snprintf(same + len, sizeof(same) - len, "%s%u", nsame ? "," : "",
+                                cs->info.crtc_id);
+        nsame++;
+    }
+    if (nsame && c) fd_printf(c->fd, "unchanged crtc=%s\n", same);
+    if (nsame == n) return 0;
+    int st = daemon_kick(d);
+
+    if (!st && wait && c) {
+        int nw = 0;
+        for (int k = 0; k < n; k++) {
+            if (skip[k]) continue;
+            c->wait_cs[nw] = css[k];
+            c->wait_ticket[nw++] = css[k]->submitted + (css[k]->pending ? 1 : 0);
+        }
+        c->nwait = nw;
+        c->wait_t0 = t0;
+    }
+    return st;
+}
+
+/* --shm: create (or reuse) the ring file. Entries already in a reused
+ * ring are not applied. return: the mapping, NULL on error (reported) */
+static struct gamma_shm *shm_create(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return NULL; }
+    struct gamma_shm *s = MAP_FAILED;
+    if (ftruncate(fd, sizeof(*s)) == 0) {
+        s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (s == MAP_FAILED) fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(fd);
+    if (s == MAP_FAILED) return NULL;
+
+    if (s->magic != GAMMA_SHM_MAGIC || s->version != GAMMA_SHM_VERSION ||
+        s->slots != GAMMA_SHM_SLOTS || s->entry_size != sizeof(struct gamma_shm_entry)) {
+        memset(s, 0, sizeof(*s));
+        s->version = GAMMA_SHM_VERSION;
+        s->slots = GAMMA_SHM_SLOTS;
+        s->entry_size = sizeof(struct gamma_shm_entry);
+        __atomic_store_n(&s->magic, GAMMA_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    return s;
+}
+
+/* Ask for an event at the next vblank of the pacing CRTC; without vblank
+ * events (CRTC off), pick up once per frame period instead. */
+static void shm_arm(struct daemon *d) {
+    struct shm_ring *r = &d->shm;
+    uint32_t type;
+    if (!crtc_vblank_type(d->fd, r->crtc_id, &type)) {
+        drmVBlank vbl = { .request = {
+            .type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | type,
+            .sequence = 1,
+            .signal = (unsigned long)d,
+        } };
+        if (!drmWaitVBlank(d->fd, &vbl)) {
+            r->armed = true;
+            return;
+        }
+    }
+    r->check_ns = now_ns() + r->period_ns;
+}
+
+/* Apply the newest ring entry, if one arrived since the last pick-up; any
+ * older unseen ones were superseded and count as coalesced. */
+static void shm_pick(struct daemon *d) {
+    struct shm_ring *r = &d->shm;
+    uint64_t head = __atomic_load_n(&r->map->head, __ATOMIC_ACQUIRE);
+    struct gamma_shm_entry e;
+    if (head == r->seen || gamma_shm_read(r->map, head, &e)) return;
+    g_stats.coalesced += head - r->seen - 1;
+    r->seen = head;
+    __atomic_store_n(&r->map->consumed, head, __ATOMIC_RELAXED);
+
+    struct crtc_targets tg = d->targets;
+    if (e.crtc_id) tg = (struct crtc_targets){ .n = 1, .ids = { e.crtc_id } };
+    uint32_t crtc_id = tg.n ? tg.ids[0] : 0;
+    uint32_t fade_ms = e.fade_ms > FADE_MAX_MS ? FADE_MAX_MS : e.fade_ms;
+    struct lut_params p;
+    char *name = e.preset;
+    e.preset[GAMMA_SHM_NAME_MAX] = '\0';
+
+    if (e.kind == GAMMA_SHM_PRESET) {
+        if (resolve_params(1, &name, d->preset_path, NULL, &p, &crtc_id)) return;
+    } else if (e.kind == GAMMA_SHM_PARAMS) {
+        if (!shm_params(e.v, &p)) {
+            fprintf(stderr, "gamma: shm entry %llu out of range; ignored\n", (unsigned long long)head);
+            return;
+        }
+        name = "";
+    } else {
+        fprintf(stderr, "gamma: shm entry %llu has unknown kind %u\n", (unsigned long long)head, e.kind);
+        return;
+    }
+    daemon_apply(d, NULL, &tg, &p, NULL, name, crtc_id, fade_ms, false, false);
+}
+
+/* poll() timeout until the next timer: adaptive tick, commit retry, legacy
+ * fade frame, restore recheck, --state save or --shm pick-up. -1 if none */
+static int daemon_timeout(const struct daemon *d, uint64_t now) {
+    int timeout = adapt_timeout(d, now);
+    if (daemon_retry_pending(d) && (timeout < 0 || timeout > 2)) timeout = 2;
+    for (int i = 0; i < d->ncrtc; i++) {
+        bool frame = d->crtc[i].fading && d->crtc[i].info.legacy;
+        if (frame && (timeout < 0 || timeout > LEGACY_FRAME_MS)) timeout = LEGACY_FRAME_MS;
+    }
+    const uint64_t due[] = { d->restore_ns, d->state_ns, d->shm.check_ns };
+    for (size_t k = 0; k < sizeof(due) / sizeof(due[0]); k++) {
+        if (!due[k]) continue;
+        int ms = due[k] <= now ? 0 : (int)((due[k] - now + 999999) / 1000000);
+        if (timeout < 0 || ms < timeout) timeout = ms;
+    }
+    return timeout;
+}
+
+/* Run the restore recheck, the --state save and the --shm pick-up once they
+ * are due. */
+static void daemon_timers(struct daemon *d, uint64_t now) {
+    if (d->restore_ns && now >= d->restore_ns) {
+        d->restore_ns = 0;
+        daemon_restore(d);
+    }
+    if (d->state_ns && now >= d->state_ns) daemon_save_state(d);
+    if (d->shm.check_ns && now >= d->shm.check_ns) {
+        d->shm.check_ns = 0;
+        shm_pick(d);
+        shm_arm(d);
+    }
+}
+
+/* One request line:
+ *   [--crtc <id>|all ...] [--output <name> ...] [--fade <ms>] [--wait] [--force]
+ *   <gamma_pow> [lift gain r g b] | <preset-name>
+ * With --wait, c->wait_cs is set and the reply is deferred until the LUTs
+ * (or newer ones that replaced them) are on screen. CRTCs that are idle and
+ * already show the result are left alone and listed in an "unchanged" line,
+ * unless --force is given. In adaptive mode "--light <value>" feeds a light
+ * sample, a plain request pauses adaptation and "--auto" resumes it.
+ * "--stats" replies with the pipeline counters, in Prometheus text format.
+ * return: exit-style status (0=ok, 1=DRM failure, 2=bad request) */
+static int daemon_request(struct daemon *d, struct client *c, char *line) {
+    char *av[MAX_REQ_ARGS];
+    int ac = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (ac == MAX_REQ_ARGS) { fprintf(stderr, "Too many arguments in request.\n"); return 2; }
+        av[ac++] = tok;
+    }
+
+    struct crtc_targets tg = { 0 };
+    uint32_t fade_ms = d->default_fade_ms;
+    bool wait = false, force = false, resume = false, light = false;
+    double level = 0;
+    char *const *blend = NULL;
+    enum blend_mode mode = BLEND_LUT;
+    int i = 0;
+    while (i < ac && av[i][0] == '-' && av[i][1] == '-') {
+        if (!strcmp(av[i], "--wait")) {
+            wait = true;
+            i++;
+            continue;
+        }
+        if (!strcmp(av[i], "--force")) {
+            force = true;
+            i++;
+            continue;
+        }
+        if (!strcmp(av[i], "--auto")) {
+            resume = true;
+            i++;
+            continue;
+        }
+        if (!strcmp(av[i], "--stats")) {
+            if (ac != 1) { fprintf(stderr, "--stats takes no other arguments.\n"); return 2; }
+            stats_write(c->fd);
+            return 0;
+        }
+        if (!strcmp(av[i], "--blend")) {
+            if (i + 3 >= ac) {
+                fprintf(stderr, "--blend takes two presets and a weight: <A> <B> <t>\n");
+                return 2;
+            }
+            blend = &av[i+1];
+            i += 4;
+            continue;
+        }
+        if (i + 1 >= ac) break;
+        if (!strcmp(av[i], "--crtc")) {
+            if (!parse_crtc_target(av[i+1], &tg)) return 2;
+        } else if (!strcmp(av[i], "--output")) {
+            if (!parse_output_target(av[i+1], &tg)) return 2;
+        } else if (!strcmp(av[i], "--fade")) {
+            if (!parse_uint32(av[i+1], &fade_ms) || fade_ms > FADE_MAX_MS) {
+                fprintf(stderr, "Invalid --fade value: %s\n", av[i+1]);
+                return 2;
+            }
+        } else if (!strcmp(av[i], "--blend-mode")) {
+            if (!parse_blend_mode(av[i+1], &mode)) return 2;
+        } else if (!strcmp(av[i], "--light")) {
+            if (!parse_double_strict(av[i+1], &level)) {
+                fprintf(stderr, "Invalid --light value: %s\n", av[i+1]);
+                return 2;
+            }
+            light = true;
+        } else {
+            fprintf(stderr, "Unknown request option: %s\n", av[i]);
+            return 2;
+        }
+        i += 2;
+    }
+    if (light || resume) {
+        if (!d->adapt.on) { fprintf(stderr, "Adaptive mode is not enabled.\n"); return 2; }
+        if (i != ac) { fprintf(stderr, "--light and --auto take no positional arguments.\n"); return 2; }
+        if (light) adapt_sample(d, level);
+        if (resume && d->adapt.paused) {
+            d->adapt.paused = false;
+            d->adapt.step = -1;
+            d->adapt.fresh = d->adapt.have_level;
+        }
+        return 0;
+    }
+    if (!tg.all && !tg.n && !tg.nout) tg = d->targets;
+
+    struct lut_params p;
+    uint32_t crtc_id = tg.n ? tg.ids[0] : 0;
+    if (mode != BLEND_LUT && !blend) { fprintf(stderr, "--blend-mode only applies to --blend.\n"); return 2; }
+    if (blend) {
+        struct lut_blend bl;
+        if (i != ac) { fprintf(stderr, "--blend takes no other positional arguments.\n"); return 2; }
+        int st = resolve_blend(blend, d->preset_path, NULL, &bl);
+        if (st) return st;
+        if (mode == BLEND_LUT) return daemon_apply(d, c, &tg, blend_color(&bl), &bl, "", crtc_id,
+                                                   fade_ms, force, wait);
+        blend_params(&bl.a, &bl.b, bl.t, &p);
+        return daemon_apply(d, c, &tg, &p, NULL, "", crtc_id, fade_ms, force, wait);
+    }
+    int st = resolve_params(ac - i, av + i, d->preset_path, NULL, &p, &crtc_id);
+    if (st) return st;
+    double num;
+    const char *preset = parse_double_strict(av[i], &num) ? "" : av[i];
+    return daemon_apply(d, c, &tg, &p, NULL, preset, crtc_id, fade_ms, force, wait);
+}
+
+static bool client_wait_done(const struct client *c) {
+    for (int k = 0; k < c->nwait; k++) {
+        const struct crtc_state *cs = c->wait_cs[k];
+        if (cs->fading || cs->pending || cs->in_flight || cs->landed < c->wait_ticket[k]) return false;
+    }
+    return true;
+}
+
+/* Serve complete request lines; stops early while a --wait reply is pending.
+ * return: false when the client is done and should be closed */
+static bool daemon_client_lines(struct daemon *d, struct client *c) {
+    while (!c->nwait) {
+        char *nl = memchr(c->buf, '\n', c->len);
+        if (!nl && !(c->eof && c->len)) break;
+
+        /* At EOF a final request without trailing newline is still served */
+        size_t used = nl ? (size_t)(nl - c->buf) + 1 : c->len;
+        if (nl) *nl = '\0';
+        int st = daemon_request(d, c, c->buf);
+        if (!c->nwait) fd_printf(c->fd, st ? "error %d\n" : "ok\n", st);
+        memmove(c->buf, c->buf + used, c->len - used + 1);
+        c->len -= used;
+    }
+    if (c->nwait) return true;
+
+    if (c->eof) return false;
+    if (c->len == sizeof(c->buf) - 1) {
+        fprintf(stderr, "Request too long, dropping client.\n");
+        fd_printf(c->fd, "error 2\n");
+        return false;
+    }
+    return true;
+}
+
+static bool daemon_client_io(struct daemon *d, struct client *c) {
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if (n < 0 && errno == EINTR) return true;
+    if (n > 0) c->len += (size_t)n;
+    else c->eof = true;
+    c->buf[c->len] = '\0';
+    return daemon_client_lines(d, c);
+}
+
+/* Send deferred --wait replies whose LUT has landed.
+ * return: false when the client is done and should be closed */
+static bool daemon_client_wake(struct daemon *d, struct client *c) {
+    /* A request served from here may itself be done already (blocking commit) */
+    while (c->nwait && client_wait_done(c)) {
+        char ids[MAX_CRTCS * 11];
+        size_t len = 0;
+        for (int k = 0; k < c->nwait; k++) {
+            len += (size_t)snprintf(ids + len, sizeof(ids) - len, "%s%u", k ? "," : "",
+                                    c->wait_cs[k]->info.crtc_id);
+        }
+        fd_printf(c->fd, "landed crtc=%s after %llu us\nok\n", ids,
+                (unsigned long long)((now_ns() - c->wait_t0) / 1000));
+        c->nwait = 0;
+        if (!daemon_client_lines(d, c)) return false;
+    }
+    return true;
+}
+
+static int run_daemon(const char *sock_path, const char *preset_path,
+                      const struct crtc_targets *targets, uint32_t default_fade_ms, bool async,
+                      const struct lut_opts *lo, const struct adapt_opts *ao,
+                      const char *state_path, const char *shm_path) {
+    struct daemon d = {
+        .fd = -1,
+        .preset_path = preset_path,
+        .targets = *targets,
+        .default_fade_ms = default_fade_ms,
+        .async = async,
+        .luts = { .opts = *lo },
+        .warm = { .efd = -1 },
+        .ifd = -1,
+        .adapt = { .on = ao != NULL, .fd = -1, .step = -1 },
+        .ufd = -1,
+        .state_path = state_path,
+        .shm = { .period_ns = SHM_PERIOD_NS },
+    };
+
+    if (ao) {
+        const char *names[2] = { ao->dark, ao->bright };
+        for (int k = 0; k < 2; k++) {
+            struct lut_params p;
+            uint32_t crtc = 0;
+            if (resolve_params(1, (char **)&names[k], preset_path, NULL, &p, &crtc)) return 2;
+        }
+        d.adapt.o = *ao;
+        if (adapt_open(&d.adapt)) return 1;
+    }
+
+    /* Requests for other CRTCs or outputs scan first (daemon_targets()) */
+    d.fd = open_topology(&d.topo, NULL, board_covers(&d.targets));
+    if (d.fd < 0) return 1;
+    d.luts.fd = d.fd;
+    if (!d.luts.opts.bits) d.luts.opts.bits = d.topo.lut_bits;
+    d.warm.opts = &d.luts.opts;
+    d.warm.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d.luts.warm = &d.warm;
+    struct crtc_state *css[MAX_CRTCS];
+    int ntargets = daemon_targets(&d, &d.targets, css);
+    if (ntargets < 0) {
+        fprintf(stderr, "Warning: default CRTC unusable; requests must name a CRTC.\n");
+    }
+    drmDropMaster(d.fd);
+
+    if (shm_path) {
+        d.shm.map = shm_create(shm_path);
+        if (!d.shm.map) { close(d.fd); return 1; }
+        d.shm.seen = __atomic_load_n(&d.shm.map->head, __ATOMIC_ACQUIRE);
+        d.shm.crtc_id = ntargets > 0 ? css[0]->info.crtc_id : d.topo.crtc[0].crtc_id;
+        shm_arm(&d);
+    }
+
+    int ls = listen_socket(sock_path);
+    if (ls < 0) { close(d.fd); return 1; }
+    daemon_watch_presets(&d);
+    d.ufd = uevent_open();
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "gamma: listening on %s\n", sock_path);
+
+    enum { PFD_LISTEN, PFD_DRM, PFD_INOTIFY, PFD_LIGHT, PFD_UEVENT, PFD_WARM, PFD_CLIENTS };
+    struct client cl[MAX_CLIENTS];
+    int ncl = 0;
+    while (!g_stop) {
+        struct pollfd pfd[PFD_CLIENTS + MAX_CLIENTS];
+        pfd[PFD_LISTEN].fd = ls;
+        pfd[PFD_LISTEN].events = POLLIN;
+        pfd[PFD_DRM].fd = d.fd;
+        pfd[PFD_DRM].events = POLLIN;
+        pfd[PFD_INOTIFY].fd = d.ifd;
+        pfd[PFD_INOTIFY].events = POLLIN;
+        pfd[PFD_LIGHT].fd = d.adapt.sampled ? -1 : d.adapt.fd;
+        pfd[PFD_LIGHT].events = POLLIN;
+        pfd[PFD_UEVENT].fd = d.ufd;
+        pfd[PFD_UEVENT].events = POLLIN;
+        pfd[PFD_WARM].fd = d.warm.efd;
+        pfd[PFD_WARM].events = POLLIN;
+        for (int k = 0; k < ncl; k++) {
+            pfd[PFD_CLIENTS + k].fd = cl[k].fd;
+            /* Stop reading from a client while its --wait reply is pending */
+            pfd[PFD_CLIENTS + k].events = (cl[k].nwait || cl[k].eof) ? 0 : POLLIN;
+        }
+
+        if (g_reload) {
+            g_reload = 0;
+            daemon_reload(&d);
+        }
+        /* Queued after startup, a preset change or a new LUT size */
+        if (d.warm.t0 && !d.warm.nthreads) {
+            warm_start(&d.warm);
+            if (!d.warm.nthreads) daemon_warm(&d);
+        }
+
+        int n = poll(pfd, PFD_CLIENTS + ncl, daemon_timeout(&d, now_ns()));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        /* Preset changes first, so no request reads a file being rewritten */
+        if (pfd[PFD_INOTIFY].revents & POLLIN) daemon_inotify(&d);
+        if (pfd[PFD_DRM].revents & POLLIN) daemon_drm_events(&d);
+        else if (n == 0) daemon_kick(&d);
+        if (pfd[PFD_UEVENT].revents & POLLIN) daemon_uevent(&d);
+        if (pfd[PFD_WARM].revents & POLLIN) daemon_warm(&d);
+        if (pfd[PFD_LIGHT].revents) adapt_read(&d);
+        adapt_tick(&d, now_ns());
+        daemon_timers(&d, now_ns());
+
+        for (int k = ncl - 1; k >= 0; k--) {
+            bool keep = true;
+            if (pfd[PFD_CLIENTS + k].revents) keep = daemon_client_io(&d, &cl[k]);
+            if (keep) keep = daemon_client_wake(&d, &cl[k]);
+            if (!keep) {
+                close(cl[k].fd);
+                cl[k] = cl[--ncl];
+            }
+        }
+
+        if (pfd[PFD_LISTEN].revents & POLLIN) {
+            int c = accept4(ls, NULL, NULL, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            if (ncl == MAX_CLIENTS) { fd_printf(c, "error 1\n"); close(c); continue; }
+            memset(&cl[ncl], 0, sizeof(cl[ncl]));
+            cl[ncl].fd = c;
+            ncl++;
+        }
+    }
+
+    for (int k = 0; k < ncl; k++) close(cl[k].fd);
+    close(ls);
+    unlink(sock_path);
+    if (d.ifd >= 0) close(d.ifd);
+    if (d.adapt.fd > 0) close(d.adapt.fd);
+    if (d.ufd >= 0) close(d.ufd);
+    if (d.shm.map) munmap(d.shm.map, sizeof(*d.shm.map));
+    if (d.state_ns) daemon_save_state(&d);
+    for (int k = 0; k < d.ncrtc; k++) free(d.crtc[k].cur);
+    warm_reset(&d.warm);
+    free(d.warm.job);
+    if (d.warm.efd >= 0) close(d.warm.efd);
+    lut_mem_free(&d.luts);
+    close(d.fd);
+    return 0;
+}
+
+/* Forward one request to a running daemon; the reply's last line is the
+ * status ("ok" or "error <code>"), everything before it is output. */
+static int run_client(const char *sock_path, int argc, char **argv) {
+    char req[REQ_LINE_MAX];
+    size_t n = 0;
+    for (int k = 0; k < argc; k++) {
+        if (strpbrk(argv[k], " \t\r\n")) {
+            fprintf(stderr, "Argument contains whitespace: '%s'\n", argv[k]);
+            return 2;
+        }
+        n += (size_t)snprintf(req + n, n < sizeof(req) ? sizeof(req) - n : 0, "%s%s", n ? " " : "", argv[k]);
+    }
+    if (n + 1 >= sizeof(req)) { fprintf(stderr, "Request too long.\n"); return 2; }
+    req[n++] = '\n';
+
+    int s = connect_socket(sock_path);
+    if (s < 0) { fprintf(stderr, "connect %s: %s\n", sock_path, strerror(errno)); return 1; }
+    if (write(s, req, n) != (ssize_t)n) { perror("write"); close(s); return 1; }
+    shutdown(s, SHUT_WR);
+
+    FILE *f = fdopen(s, "r");
+    if (!f) { perror("fdopen"); close(s); return 1; }
+    char line[REQ_LINE_MAX], prev[REQ_LINE_MAX] = "";
+    bool have_prev = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (have_prev) fputs(prev, stdout);
+        memcpy(prev, line, sizeof(line));
+        have_prev = true;
+    }
+    fclose(f);
+
+    if (!have_prev) { fprintf(stderr, "No reply from daemon.\n"); return 1; }
+    if (!strncmp(prev, "ok", 2)) return 0;
+    int code = 1;
+    if (sscanf(prev, "error %d", &code) != 1 || code == 0) code = 1;
+    return code;
+}
+
+/* Forward args[0..n) to the daemon. *nfwd counts every forwarded argument,
+ * so one that did not fit in fwd still fails the client's size check. */
+static void fwd_args(char **fwd, int *nfwd, char **args, int n) {
+    for (int k = 0; k < n; k++, (*nfwd)++)
+        if (*nfwd < MAX_REQ_ARGS) fwd[*nfwd] = args[k];
+}
+
+/* ------------------- main ------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t crtc_id = DEFAULT_CRTC;
+    struct crtc_targets tg = { 0 };
+    const char *preset_path = NULL;
+    const char *sock_path = NULL;
+    bool list_mode = false;
+    bool daemon_mode = false;
+    bool stats_mode = false;
+    uint32_t fade_ms = 0;
+    bool async = false;
+    bool wait = false;
+    bool force = false;
+    struct lut_opts lo = { .cache_dir = LUT_CACHE_DIR, .kernel = LUT_KERNEL_REF, .dither = LUT_DITHER_DIFFUSE };
+    bool verify_mode = false;
+    uint32_t bench_iters = 0;
+    bool cpu_only = false;
+    bool outputs_mode = false;
+    bool board_profile = false;
+    const char *topo_cache = TOPOLOGY_CACHE;
+    const char *compile_src = NULL;
+    const char *compile_out = NULL;
+    uint32_t lut_sizes[DB_MAX_LUT_SIZES];
+    int nlut_sizes = 0;
+    const char *lut_file_path = NULL;
+    const char *batch_path = NULL;
+    const char *boot_path = NULL, *save_boot_path = NULL, *state_path = NULL, *shm_path = NULL;
+    struct adapt_opts ao = { .lo = 0.0, .hi = 1.0 };
+    char adapt_names[2 * (INI_NAME_MAX + 1)];
+    bool adaptive = false, light_range = false, resume = false;
+    const char *light = NULL;
+    char **blend = NULL;
+    enum blend_mode blend_mode = BLEND_LUT;
+    bool blend_mode_set = false;
+    bool dump_mode = false;
+    enum dump_format dump_format = DUMP_SUMMARY;
+    /* Request options forwarded verbatim in client mode */
+    char *fwd[MAX_REQ_ARGS];
+    int nfwd = 0;
+
+    int i = 1;
+    while (i < argc) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--list")) {
+            list_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--daemon")) {
+            daemon_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--stats")) {
+            stats_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--dump")) {
+            dump_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--dump-format")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--dump-format requires summary, csv or raw.\n");
+                return 2;
+            }
+            if (!parse_dump_format(argv[i+1], &dump_format)) return 2;
+            dump_mode = true;
+            i += 2;
+        } else if (!strcmp(argv[i], "--outputs")) {
+            outputs_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--board-profile")) {
+            board_profile = true;
+            i++;
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            lo.cache_dir = NULL;
+            topo_cache = NULL;
+            i++;
+        } else if (!strcmp(argv[i], "--fast")) {
+            lo.kernel = LUT_KERNEL_FAST;
+            i++;
+        } else if (!strcmp(argv[i], "--lut-bits")) {
+            if (i + 1 >= argc || !parse_uint32(argv[i+1], &lo.bits) ||
+                lo.bits < LUT_BITS_MIN || lo.bits > LUT_BITS_MAX) {
+                fprintf(stderr, "--lut-bits takes the effective LUT precision (%d..%d).\n",
+                        LUT_BITS_MIN, LUT_BITS_MAX);
+                return 2;
+            }
+            i += 2;
+        } else if (!strcmp(argv[i], "--dither")) {
+            int k = 0;
+            while (i + 1 < argc && k < 3 && strcmp(argv[i+1], lut_dither_names[k])) k++;
+            if (i + 1 >= argc || k == 3) {
+                fprintf(stderr, "--dither takes none, ordered or diffuse.\n");
+                return 2;
+            }
+            lo.dither = (enum lut_dither)k;
+            i += 2;
+        } else if (!strcmp(argv[i], "--verify")) {
+            verify_mode = true;
+            i++;
+        } else if (!strcmp(argv[i], "--bench")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--bench requires an iteration count.\n");
+                return 2;
+            }
+            if (!parse_uint32(argv[i+1], &bench_iters) || !bench_iters || bench_iters > BENCH_MAX_ITERS) {
+                fprintf(stderr, "Invalid --bench value: %s (1..%d)\n", argv[i+1], BENCH_MAX_ITERS);
+                return 2;
+            }
+            i += 2;
+        } else if (!strcmp(argv[i], "--cpu-only")) {
+            cpu_only = true;
+            i++;
+        } else if (!strcmp(argv[i], "--compile")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--compile requires a presets.ini path.\n");
+                return 2;
+            }
+            compile_src = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "-o")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "-o requires an output path.\n");
+                return 2;
+            }
+            compile_out = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--lut-sizes")) {
+            if (i + 1 >= argc || !parse_lut_sizes(argv[i+1], lut_sizes, &nlut_sizes)) {
+                fprintf(stderr, "--lut-sizes takes up to %d comma-separated sizes (2..%d).\n",
+                        DB_MAX_LUT_SIZES, DB_LUT_SIZE_MAX);
+                return 2;
+            }
+            i += 2;
+        } else if (!strcmp(argv[i], "--lut-file")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--lut-file requires a path (or - for stdin).\n");
+                return 2;
+            }
+            lut_file_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--adaptive")) {
+            char *comma = NULL;
+            if (i + 1 < argc && strlen(argv[i+1]) < sizeof(adapt_names)) {
+                strcpy(adapt_names, argv[i+1]);
+                comma = strchr(adapt_names, ',');
+            }
+            if (!comma || comma == adapt_names || !comma[1]) {
+                fprintf(stderr, "--adaptive takes two presets: <dark>,<bright>\n");
+                return 2;
+            }
+            *comma = '\0';
+            ao.dark = adapt_names;
+            ao.bright = comma + 1;
+            adaptive = true;
+            i += 2;
+        } else if (!strcmp(argv[i], "--light")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--light requires a source (daemon) or a value (--socket).\n");
+                return 2;
+            }
+            light = argv[i+1];
+            fwd_args(fwd, &nfwd, &argv[i], 2);
+            i += 2;
+        } else if (!strcmp(argv[i], "--light-range")) {
+            char *end = NULL;
+            if (i + 1 < argc) {
+                ao.lo = strtod(argv[i+1], &end);
+                if (end != argv[i+1] && *end == ',') ao.hi = strtod(end + 1, &end);
+            }
+            if (!end || *end || !isfinite(ao.lo) || !isfinite(ao.hi) || ao.lo == ao.hi) {
+                fprintf(stderr, "--light-range takes two different values: <dark>,<bright>\n");
+                return 2;
+            }
+            light_range = true;
+            i += 2;
+        } else if (!strcmp(argv[i], "--auto")) {
+            resume = true;
+            fwd_args(fwd, &nfwd, &argv[i], 1);
+            i++;
+        } else if (!strcmp(argv[i], "--boot")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--boot requires a snapshot path.\n");
+                return 2;
+            }
+            boot_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--save-boot")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--save-boot requires a snapshot path.\n");
+                return 2;
+            }
+            save_boot_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--state")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--state requires a snapshot path.\n");
+                return 2;
+            }
+            state_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--shm")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--shm requires a ring file path.\n");
+                return 2;
+            }
+            shm_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--batch")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--batch requires a file (or - for stdin).\n");
+                return 2;
+            }
+            batch_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--async")) {
+            async = true;
+            i++;
+        } else if (!strcmp(argv[i], "--wait")) {
+            wait = true;
+            fwd_args(fwd, &nfwd, &argv[i], 1);
+            i++;
+        } else if (!strcmp(argv[i], "--force")) {
+            force = true;
+            fwd_args(fwd, &nfwd, &argv[i], 1);
+            i++;
+        } else if (!strcmp(argv[i], "--crtc")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--crtc requires an argument.\n");
+                return 2;
+            }
+            if (!parse_crtc_target(argv[i+1], &tg)) {
+                print_usage(argv[0]); return 2;
+            }
+            fwd_args(fwd, &nfwd, &argv[i], 2);
+            i += 2;
+        } else if (!strcmp(argv[i], "--output")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--output requires a connector name (e.g. HDMI-A-1).\n");
+                return 2;
+            }
+            if (!parse_output_target(argv[i+1], &tg)) return 2;
+            fwd_args(fwd, &nfwd, &argv[i], 2);
+            i += 2;
+        } else if (!strcmp(argv[i], "--fade")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--fade requires a duration in ms.\n");
+                return 2;
+            }
+            if (!parse_uint32(argv[i+1], &fade_ms) || fade_ms > FADE_MAX_MS) {
+                fprintf(stderr, "Invalid --fade value: %s (0..%d ms)\n", argv[i+1], FADE_MAX_MS);
+                return 2;
+            }
+            fwd_args(fwd, &nfwd, &argv[i], 2);
+            i += 2;
+        } else if (!strcmp(argv[i], "--blend")) {
+            if (i + 3 >= argc) {
+                fprintf(stderr, "--blend requires two presets and a weight (0..1).\n");
+                return 2;
+            }
+            blend = &argv[i+1];
+            fwd_args(fwd, &nfwd, &argv[i], 4);
+            i += 4;
+        } else if (!strcmp(argv[i], "--blend-mode")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--blend-mode requires lut or params.\n");
+                return 2;
+            }
+            if (!parse_blend_mode(argv[i+1], &blend_mode)) return 2;
+            blend_mode_set = true;
+            fwd_args(fwd, &nfwd, &argv[i], 2);
+            i += 2;
+        } else if (!strcmp(argv[i], "--presets")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--presets requires a filepath argument.\n");
+                return 2;
+            }
+            preset_path = argv[i+1];
+            i += 2;
+        } else if (!strcmp(argv[i], "--socket")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--socket requires a path argument.\n");
+                return 2;
+            }
+            sock_path = argv[i+1];
+            i += 2;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 2;
+        } else {
+            break;
+        }
+    }
+
+    /* Early boot: nothing but the snapshot */
+    if (boot_path) {
+        if (argc != 3) {
+            fprintf(stderr, "--boot takes only the snapshot path.\n");
+            return 2;
+        }
+        return run_boot(boot_path);
+    }
+
+    if (compile_src) {
+        if (i != argc) {
+            fprintf(stderr, "--compile does not take positional arguments.\n");
+            return 2;
+        }
+        char out[PATH_MAX];
+        if (!compile_out) {
+            if (!db_sibling(compile_src, out, sizeof(out))) {
+                fprintf(stderr, "Output path too long; pass -o.\n");
+                return 2;
+            }
+            compile_out = out;
+        }
+        return run_compile(compile_src, compile_out, lut_sizes, nlut_sizes, &lo);
+    }
+    if (compile_out || nlut_sizes) {
+        fprintf(stderr, "-o and --lut-sizes only apply to --compile.\n");
+        return 2;
+    }
+
+    if (lut_file_path && (sock_path || daemon_mode || list_mode || outputs_mode ||
+                          verify_mode || bench_iters)) {
+        fprintf(stderr, "--lut-file only applies to a direct apply.\n");
+        return 2;
+    }
+    if (save_boot_path && (batch_path || sock_path || daemon_mode || list_mode || outputs_mode ||
+                           verify_mode || bench_iters || stats_mode || fade_ms || async || wait)) {
+        fprintf(stderr, "--save-boot only takes the targets and the LUT to save.\n");
+        return 2;
+    }
+    if (batch_path && (lut_file_path || sock_path || daemon_mode || list_mode || outputs_mode ||
+                       verify_mode || bench_iters || stats_mode || i != argc)) {
+        fprintf(stderr, "--batch takes its steps from the file alone.\n");
+        return 2;
+    }
+    if (blend && (lut_file_path || batch_path || daemon_mode || list_mode || outputs_mode ||
+                  verify_mode || bench_iters || stats_mode || i != argc)) {
+        fprintf(stderr, "--blend takes its two presets in place of the positional arguments.\n");
+        return 2;
+    }
+    if (dump_mode && (lut_file_path || batch_path || save_boot_path || blend || sock_path || daemon_mode ||
+                      list_mode || outputs_mode || verify_mode || bench_iters || stats_mode ||
+                      fade_ms || async || wait || force || i != argc)) {
+        fprintf(stderr, "--dump only takes the targets, --presets and the LUT options to match with.\n");
+        return 2;
+    }
+    if (blend_mode_set && !blend) {
+        fprintf(stderr, "--blend-mode only applies to --blend.\n");
+        return 2;
+    }
+    if (force && (daemon_mode || list_mode || outputs_mode || verify_mode || bench_iters)) {
+        fprintf(stderr, "--force only applies to applying a LUT.\n");
+        return 2;
+    }
+    if ((adaptive || light_range || state_path || shm_path) && !daemon_mode) {
+        fprintf(stderr, "--adaptive, --light-range, --state and --shm only apply to --daemon.\n");
+        return 2;
+    }
+    if (daemon_mode && ((light && !adaptive) || resume)) {
+        fprintf(stderr, "A --daemon takes --light <source> with --adaptive only.\n");
+        return 2;
+    }
+    if (!daemon_mode && (light || resume) && !sock_path) {
+        fprintf(stderr, "--light <value> and --auto are daemon requests; add --socket.\n");
+        return 2;
+    }
+    ao.source = light;
+
+    if (stats_mode) {
+        if (i != argc || daemon_mode || nfwd) {
+            fprintf(stderr, "--stats only takes --socket.\n");
+            return 2;
+        }
+        char *req[] = { "--stats" };
+        return run_client(sock_path ? sock_path : DEFAULT_SOCKET, 1, req);
+    }
+
+    /* Client mode: the daemon resolves presets and its own default CRTC */
+    if (sock_path && !daemon_mode && !list_mode && !outputs_mode && !board_profile) {
+        if (i >= argc && !light && !resume && !blend) {
+            fprintf(stderr, "Missing arguments.\n");
+            print_usage(argv[0]); return 2;
+        }
+        if (nfwd + argc - i > MAX_REQ_ARGS) {
+            fprintf(stderr, "Too many arguments.\n");
+            return 2;
+        }
+        while (i < argc) fwd[nfwd++] = argv[i++];
+        return run_client(sock_path, nfwd, fwd);
+    }
+
+    if (!tg.all && !tg.n && !tg.nout) {
+        uint32_t config_crtc = 0;
+        int st = load_config_crtc(preset_path, &config_crtc);
+        if (st < 0) return 2;
+        if (st > 0) crtc_id = config_crtc;
+        tg.ids[tg.n++] = crtc_id;
+        tg.is_default = true;
+    }
+    crtc_id = tg.ids[0];
+
+    if (dump_mode) return run_dump(&tg, topo_cache, preset_path, &lo, dump_format);
+
+    if (outputs_mode) {
+        if (i != argc) {
+            fprintf(stderr, "--outputs does not take positional arguments.\n");
+            return 2;
+        }
+        /* Always a fresh scan, which also refreshes the cache */
+        struct topology topo;
+        int fd = open_topology(&topo, NULL, false);
+        if (fd < 0) return 1;
+        if (topo_cache) topology_store(topo_cache, &topo);
+        print_topology(&topo);
+        close(fd);
+        return 0;
+    }
+
+    if (board_profile) {
+        if (i != argc || daemon_mode || list_mode || verify_mode || bench_iters || lut_file_path ||
+            batch_path || save_boot_path || blend) {
+            fprintf(stderr, "--board-profile only takes --crtc or --output.\n");
+            return 2;
+        }
+        return run_board_profile(&tg);
+    }
+
+    if (verify_mode) {
+        if (i != argc) {
+            fprintf(stderr, "--verify does not take positional arguments.\n");
+            return 2;
+        }
+        return run_verify(preset_path);
+    }
+
+    if (bench_iters) {
+        if (tg.all || tg.n + tg.nout > 1) {
+            fprintf(stderr, "--bench takes a single --crtc or --output.\n");
+            return 2;
+        }
+        /* Optional preset/params to time with; defaults to "reset" */
+        struct lut_params p = { .gamma = 1.0, .gain = 1.0, .r = 1.0, .g = 1.0, .b = 1.0 };
+        if (i < argc) {
+            int st = resolve_params(argc - i, argv + i, preset_path, argv[0], &p, &crtc_id);
+            if (st) return st;
+        }
+        if (crtc_targets_single(&tg) && crtc_id != tg.ids[0]) {
+            tg.ids[0] = crtc_id;
+            tg.is_default = false;
+        }
+        return run_bench(bench_iters, cpu_only, &tg, &p, lo.kernel);
+    }
+    if (cpu_only) {
+        fprintf(stderr, "--cpu-only only applies to --bench.\n");
+        return 2;
+    }
+
+    if (list_mode) {
+        if (i != argc) {
+            fprintf(stderr, "--list does not take positional arguments.\n");
+            return 2;
+        }
+        list_all_presets(preset_path);
+        return 0;
+    }
+
+    if (daemon_mode) {
+        if (i != argc) {
+            fprintf(stderr, "--daemon does not take positional arguments.\n");
+            return 2;
+        }
+        return run_daemon(sock_path ? sock_path : DEFAULT_SOCKET, preset_path, &tg, fade_ms, async, &lo,
+                          adaptive ? &ao : NULL, state_path, shm_path);
+    }
+
+    /* --lut-file replaces the curve; DEGAMMA_LUT and CTM go to bypass */
+    struct lut_params p = { .gamma = 1.0, .gain = 1.0, .r = 1.0, .g = 1.0, .b = 1.0 };
+    struct lut_file lf;
+    struct lut_blend bl;
+    if (lut_file_path) {
+        if (i != argc) {
+            fprintf(stderr, "--lut-file does not take positional arguments.\n");
+            return 2;
+        }
+        if (lut_file_open(&lf, lut_file_path)) return 2;
+        lo.file = &lf;
+    } else if (blend) {
+        /* lut: both LUTs come through the caches and are mixed at build
+         * time; params: a single curve from the mixed parameters */
+        int st = resolve_blend(blend, preset_path, argv[0], &bl);
+        if (st) return st;
+        if (blend_mode == BLEND_LUT) {
+            p = *blend_color(&bl);
+            lo.blend = &bl;
+        } else {
+            blend_params(&bl.a, &bl.b, bl.t, &p);
+        }
+    } else if (!batch_path) {
+        int st = resolve_params(argc - i, argv + i, preset_path, argv[0], &p, &crtc_id);
+        if (st) return st;
+        if (crtc_targets_single(&tg) && crtc_id != tg.ids[0]) {
+            tg.ids[0] = crtc_id;
+            tg.is_default = false;
+        }
+    }
+
+    struct apply_ctx ac = {
+        .fade_ms = fade_ms, .force = force, .wait = wait, .lo = &lo, .topo_cache = topo_cache,
+    };
+    /* A batch step may name another CRTC (a preset's crtc key) */
+    ac.board = board_covers(&tg) && !batch_path;
+    ac.fd = open_topology(&ac.topo, topo_cache, ac.board);
+    if (ac.fd < 0) return 1;
+    if (!lo.bits) lo.bits = ac.topo.lut_bits;
+
+    /* --async alone returns as soon as the commit is queued; --wait reports
+     * when the LUT is actually on screen. */
+    if (async) ac.flags |= DRM_MODE_ATOMIC_NONBLOCK;
+    if (async && wait) ac.flags |= DRM_MODE_PAGE_FLIP_EVENT;
+
+    int ret;
+    if (save_boot_path) {
+        struct crtc_info ci[MAX_CRTCS];
+        int n = resolve_targets(&ac.topo, &tg, ci);
+        ret = n > 0 ? save_boot(save_boot_path, ac.topo.card, ci, n, &p, &lo) : 1;
+    } else {
+        ret = batch_path ? run_batch(&ac, batch_path, &tg, preset_path) : apply_params(&ac, &tg, &p);
+    }
+
+    if (ac.fd >= 0) close(ac.fd);
+    if (lo.file) lut_file_close(&lf);
+    return ret;
+}
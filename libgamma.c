@@ -0,0 +1,136 @@
+// libgamma.c — libgamma.h on top of gamma-core.c
+//
+// The library links the same core as the CLI and daemon (gamma-core.h),
+// so it runs exactly the code they run. Build with `make lib`.
+
+#define _GNU_SOURCE 1
+#include "gamma-core.h"
+#include "libgamma.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(struct lut_params) <= sizeof(gamma_params), "gamma_params too small");
+_Static_assert(sizeof(struct gamma_lut_entry) == sizeof(struct drm_color_lut), "LUT entry layout");
+
+struct gamma_ctx {
+    int fd;
+    struct topology topo;
+    struct lut_opts lo;
+    bool own_presets;            /* presets holds a --presets path */
+    char presets[PATH_MAX];
+};
+
+GAMMA_API int gamma_api_version(void) {
+    return GAMMA_API_VERSION;
+}
+
+GAMMA_API gamma_ctx *gamma_open(const char *presets, unsigned int flags) {
+    if (presets && strlen(presets) >= PATH_MAX) { errno = ENAMETOOLONG; return NULL; }
+    gamma_ctx *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+    if (presets) {
+        strcpy(g->presets, presets);
+        g->own_presets = true;
+    }
+    /* Callers may drive any CRTC; the board profile only knows DEFAULT_CRTC */
+    g->fd = open_topology(&g->topo, flags & GAMMA_OPEN_NO_CACHE ? NULL : TOPOLOGY_CACHE, false);
+    if (g->fd < 0) {
+        int e = errno ? errno : ENODEV;
+        free(g);
+        errno = e;
+        return NULL;
+    }
+    g->lo = (struct lut_opts){
+        .kernel = flags & GAMMA_OPEN_FAST ? LUT_KERNEL_FAST : LUT_KERNEL_REF,
+        .bits = g->topo.lut_bits,
+        .dither = LUT_DITHER_DIFFUSE,
+    };
+    return g;
+}
+
+GAMMA_API void gamma_close(gamma_ctx *g) {
+    if (!g) return;
+    close(g->fd);
+    free(g);
+}
+
+GAMMA_API int gamma_crtcs(const gamma_ctx *g, uint32_t *ids, int max) {
+    for (int k = 0; k < g->topo.ncrtc && k < max; k++) ids[k] = g->topo.crtc[k].crtc_id;
+    return g->topo.ncrtc;
+}
+
+GAMMA_API int gamma_lut_size(const gamma_ctx *g, uint32_t crtc_id) {
+    const struct crtc_info *ci = topology_crtc(&g->topo, crtc_id);
+    return ci && ci->lut_size ? (int)ci->lut_size : -ENODEV;
+}
+
+GAMMA_API int gamma_preset(gamma_ctx *g, const char *name, gamma_params *p) {
+    struct preset_vals pv;
+    int st = load_preset(name, g->own_presets ? g->presets : NULL, &pv);
+    if (st == 0) return -ENOENT;
+    if (st < 0 || !preset_to_params(&pv, (struct lut_params *)p)) return -EINVAL;
+    return 0;
+}
+
+GAMMA_API int gamma_curve(gamma_params *p, double gamma, double lift, double gain,
+                          double r, double g, double b) {
+    const double v[6] = { gamma, lift, gain, r, g, b };
+    /* Same ranges as a --shm entry or the command line */
+    if (!shm_params(v, (struct lut_params *)p)) return -ERANGE;
+    return 0;
+}
+
+GAMMA_API int gamma_build_lut(const gamma_ctx *g, const gamma_params *p,
+                              struct gamma_lut_entry *lut, uint32_t size) {
+    if (size < 2) return -EINVAL;
+    build_lut_opts(&g->lo, (const struct lut_params *)p, (struct drm_color_lut *)lut, size);
+    return 0;
+}
+
+GAMMA_API int gamma_blend_lut(const gamma_ctx *g, const struct gamma_lut_entry *a,
+                              const struct gamma_lut_entry *b, struct gamma_lut_entry *out,
+                              uint32_t size, double t) {
+    if (!(t >= 0.0 && t <= 1.0)) return -EINVAL;
+    blend_lut((const struct drm_color_lut *)a, (const struct drm_color_lut *)b,
+              (struct drm_color_lut *)out, size, t, g->lo.bits, g->lo.dither);
+    return 0;
+}
+
+GAMMA_API int gamma_blend_params(const gamma_params *a, const gamma_params *b, double t,
+                                 gamma_params *out) {
+    if (!(t >= 0.0 && t <= 1.0)) return -EINVAL;
+    struct lut_params p;
+    blend_params((const struct lut_params *)a, (const struct lut_params *)b, t, &p);
+    *(struct lut_params *)out = p;     /* out may be a or b */
+    return 0;
+}
+
+GAMMA_API int gamma_commit(gamma_ctx *g, uint32_t crtc_id, const struct gamma_lut_entry *lut,
+                           uint32_t size, const gamma_params *color) {
+    const struct crtc_info *ci = topology_crtc(&g->topo, crtc_id);
+    if (!ci) return -ENODEV;
+    if (size != ci->lut_size) return -EINVAL;
+    const struct drm_color_lut *l = (const struct drm_color_lut *)lut;
+    const struct lut_params *c = (const struct lut_params *)color;
+
+    int ret = commit_gamma_master(g->fd, &ci, &l, NULL, &c, 1, 0, NULL);
+    return ret > 0 ? -EIO : ret;
+}
+
+struct preset_cb {
+    void (*fn)(const char *name, void *user);
+    void *user;
+};
+
+static void preset_cb_one(const char *name, void *ctx) {
+    struct preset_cb *cb = ctx;
+    cb->fn(name, cb->user);
+}
+
+GAMMA_API void gamma_presets(gamma_ctx *g, void (*fn)(const char *name, void *user), void *user) {
+    struct preset_cb cb = { fn, user };
+    foreach_preset(g->own_presets ? g->presets : NULL, preset_cb_one, &cb);
+}
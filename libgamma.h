@@ -0,0 +1,111 @@
+// libgamma.h — the core of gamma (gamma-core.c) as a library (libgamma.a / libgamma.so)
+//
+// Open the card once, then per update: look up a preset (or set a curve),
+// build its LUT into a buffer of your own and commit it. Nothing on that
+// path allocates memory or re-reads the card's properties:
+//
+//   gamma_ctx *g = gamma_open(NULL, 0);
+//   uint32_t crtc;
+//   gamma_crtcs(g, &crtc, 1);
+//   struct gamma_lut_entry lut[4096];
+//   int size = gamma_lut_size(g, crtc);
+//   gamma_params p;
+//   if (!gamma_preset(g, "milos1", &p) && !gamma_build_lut(g, &p, lut, size))
+//       gamma_commit(g, crtc, lut, size, &p);
+//   gamma_close(g);
+//
+// Link: -lgamma $(pkg-config --libs libdrm) -lm
+//
+// All functions return 0 (or a count) on success and a negative errno on
+// failure; DRM errors are also reported on stderr, like the CLI does.
+
+#ifndef LIBGAMMA_H
+#define LIBGAMMA_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GAMMA_API_VERSION 2
+
+#if defined(__GNUC__)
+#define GAMMA_API __attribute__((visibility("default")))
+#else
+#define GAMMA_API
+#endif
+
+typedef struct gamma_ctx gamma_ctx;
+
+/* A resolved curve: a preset (with its DEGAMMA_LUT/CTM and per-channel
+ * keys) or plain values. Opaque; the size is part of the ABI. */
+typedef struct gamma_params {
+    double opaque[32];
+} gamma_params;
+
+/* Same layout as the kernel's struct drm_color_lut */
+struct gamma_lut_entry {
+    uint16_t red, green, blue, reserved;
+};
+
+/* gamma_open() flags */
+#define GAMMA_OPEN_NO_CACHE 0x1  /* scan the card instead of using the topology cache */
+#define GAMMA_OPEN_FAST     0x2  /* build LUTs with the single-precision kernel */
+
+/* return: GAMMA_API_VERSION of the library */
+GAMMA_API int gamma_api_version(void);
+
+/* Open the display card and discover its CRTCs. presets: the INI (or
+ * compiled .bin) to read; NULL = ./presets.ini, then /etc/gamma-presets.ini.
+ * return: the context, NULL with errno set */
+GAMMA_API gamma_ctx *gamma_open(const char *presets, unsigned int flags);
+GAMMA_API void gamma_close(gamma_ctx *g);
+
+/* The CRTCs that take a LUT. return: how many there are (ids gets up to max) */
+GAMMA_API int gamma_crtcs(const gamma_ctx *g, uint32_t *ids, int max);
+
+/* return: the LUT size of crtc_id, -ENODEV if it takes no LUT */
+GAMMA_API int gamma_lut_size(const gamma_ctx *g, uint32_t crtc_id);
+
+/* Look up a preset ("reset" is built in).
+ * return: 0, -ENOENT if there is no such preset, -EINVAL if it does not load */
+GAMMA_API int gamma_preset(gamma_ctx *g, const char *name, gamma_params *p);
+
+/* Plain values, as on the command line. return: 0, -ERANGE */
+GAMMA_API int gamma_curve(gamma_params *p, double gamma, double lift, double gain,
+                          double r, double g, double b);
+
+/* Build the GAMMA_LUT for p into lut[0..size), rounded to the driver's
+ * precision like the CLI does. return: 0, -EINVAL for size < 2 */
+GAMMA_API int gamma_build_lut(const gamma_ctx *g, const gamma_params *p,
+                              struct gamma_lut_entry *lut, uint32_t size);
+
+/* Mix a and b at t (0 = a, 1 = b) entry by entry into out, which may be
+ * a: no pow(), and rounded to the driver's precision like gamma_build_lut().
+ * Since version 2. return: 0, -EINVAL for t outside 0..1 */
+GAMMA_API int gamma_blend_lut(const gamma_ctx *g, const struct gamma_lut_entry *a,
+                              const struct gamma_lut_entry *b, struct gamma_lut_entry *out,
+                              uint32_t size, double t);
+
+/* Mix the curve parameters of a and b at t into out; DEGAMMA_LUT and CTM
+ * come from the nearer one. Since version 2. return: 0, -EINVAL */
+GAMMA_API int gamma_blend_params(const gamma_params *a, const gamma_params *b, double t,
+                                 gamma_params *out);
+
+/* Put lut on crtc_id (size must be its gamma_lut_size()). With color, p's
+ * DEGAMMA_LUT and CTM are set in the same atomic commit; NULL leaves them.
+ * DRM master is taken for the commit only (two more ioctls).
+ * return: 0, -ENODEV, -EINVAL, -EACCES if another client holds DRM master,
+ * or the commit's error */
+GAMMA_API int gamma_commit(gamma_ctx *g, uint32_t crtc_id, const struct gamma_lut_entry *lut,
+                           uint32_t size, const gamma_params *color);
+
+/* Call fn for every preset name in the search path */
+GAMMA_API void gamma_presets(gamma_ctx *g, void (*fn)(const char *name, void *user), void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBGAMMA_H */